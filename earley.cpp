@@ -15,7 +15,7 @@ using namespace earley;
 namespace earley
 {
 
-size_t hashtable_collisions = 0;
+thread_local size_t hashtable_collisions = 0;
 
 ItemSetList
 invert_items(const ItemSetList& item_sets)
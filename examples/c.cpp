@@ -1,6 +1,8 @@
 #include <chrono>
+#include <cstdlib>
 
 #include <earley/fast.hpp>
+#include <earley/fast/parallel.hpp>
 #include "earley/timer.hpp"
 #include "grammar.hpp"
 #include <lexertl/generator.hpp>
@@ -389,7 +391,7 @@ get_tokens(const char* file)
 }
 
 void
-parse_c(const char* file, bool dump)
+parse_c(const char* file, bool dump, size_t threads)
 {
 #if 0
   lexertl::memory_file c_bnf("grammar/c_raw");
@@ -418,26 +420,16 @@ parse_c(const char* file, bool dump)
 
   std::cout << "Building grammar" << std::endl;
   earley::fast::TerminalList symbols(tokens.begin(), tokens.end());
-  earley::fast::grammar::Grammar built("start", ::c_grammar, ::c_terminals);
 
-  auto valid = built.validate();
-
-  if (!valid.is_valid())
-  {
-    std::cerr << "Error: grammar is not valid\n"
-      << "-- Undefined rules --\n";
-
-    for (auto& rule: valid.undefined())
-    {
-      std::cerr << rule << "\n";
-    }
-
-    std::cerr << std::endl;
-    throw Terminate();
-  }
+  // The generator has already checked and compiled the grammar.
+  earley::Timer build_timer;
+  auto compiled = earley::fast::compile(::c_tables);
+  std::cout << "Building grammar took "
+    << build_timer.count<std::chrono::microseconds>() << " microseconds"
+    << std::endl;
 
   std::cout << "Parsing " << symbols.size() << " tokens" << std::endl;
-  earley::fast::Parser parser(built, symbols);
+  earley::fast::Parser parser(compiled, symbols);
 
   size_t i;
   try {
@@ -463,6 +455,26 @@ parse_c(const char* file, bool dump)
     std::cout << "HashTable collisions "
               << earley::hashtable_collisions << std::endl;
 
+    if (threads > 0)
+    {
+      // Cut after a ';' or '}' that isn't inside any brackets.
+      earley::fast::CutTerminals terminals{{';', '}'},
+        {{'{', '}'}, {'(', ')'}, {'[', ']'}}};
+
+      earley::Timer parallel_timer;
+      auto cuts = earley::fast::cut_points(symbols, terminals);
+      earley::fast::ParallelParser parallel(*compiled, threads);
+      auto error = parallel.recognise(symbols, cuts);
+      auto& stats = parallel.stats();
+
+      std::cout << "Recognising on " << threads << " threads took "
+        << parallel_timer.count<std::chrono::microseconds>()
+        << " microseconds, " << stats.chunks << " chunks, "
+        << stats.rounds << " rounds, " << stats.reparsed
+        << " tokens parsed again" << (error ? ", failed" : "")
+        << std::endl;
+    }
+
     //throw "foo";
   } catch(...)
   {
@@ -494,7 +506,8 @@ int main(int argc, char** argv)
 
   try
   {
-    parse_c(argv[1], true);
+    // An optional number of threads to recognise it on as well.
+    parse_c(argv[1], true, argc > 2 ? std::atoi(argv[2]) : 0);
   }
   catch (const char* c)
   {
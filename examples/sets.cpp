@@ -0,0 +1,99 @@
+#include <iostream>
+#include <random>
+
+#include <earley/fast.hpp>
+#include <earley/timer.hpp>
+#include <lexertl/memory_file.hpp>
+
+#include "earley.hpp"
+#include "grammar.hpp"
+
+// Times the first and follow sets of the C grammar, and of random
+// grammars with more and more rules.
+
+namespace
+{
+  using namespace earley::fast::grammar;
+
+  void
+  time_sets(const char* name, int start, const std::vector<RuleList>& rules)
+  {
+    const int runs = 5;
+
+    earley::Timer timer;
+    for (int i = 0; i != runs; ++i)
+    {
+      auto firsts = first_sets(rules);
+      follow_sets(start, rules, firsts);
+    }
+
+    size_t count = 0;
+    for (auto& rule_list: rules)
+    {
+      count += rule_list.size();
+    }
+
+    std::cout << name << ": " << rules.size() << " nonterminals, "
+      << count << " rules, "
+      << timer.count<std::chrono::microseconds>() / runs
+      << " microseconds" << std::endl;
+  }
+
+  // Each nonterminal has one to three rules of up to four symbols, which
+  // are a random mix of terminals and nonterminals.
+  std::vector<RuleList>
+  random_grammar(int nonterminals, std::mt19937& random)
+  {
+    std::vector<RuleList> rules(nonterminals);
+    for (int nt = 0; nt != nonterminals; ++nt)
+    {
+      auto count = 1 + random() % 3;
+      for (size_t i = 0; i != count; ++i)
+      {
+        std::vector<Symbol> symbols;
+        auto length = random() % 5;
+        for (size_t j = 0; j != length; ++j)
+        {
+          if (random() % 2)
+          {
+            symbols.push_back({static_cast<int>(random() % 200), true});
+          }
+          else
+          {
+            symbols.push_back({static_cast<int>(random() % nonterminals),
+              false});
+          }
+        }
+        rules[nt].push_back(Rule(nt, std::move(symbols)));
+      }
+    }
+
+    return rules;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  const char* path = argc > 1 ? argv[1] : "grammar/c_raw";
+  lexertl::memory_file raw(path);
+
+  if (raw.data() == nullptr)
+  {
+    std::cerr << "Unable to open " << path << std::endl;
+    return 1;
+  }
+
+  std::string text(raw.data(), raw.data() + raw.size());
+  auto [grammar, terminals, start] = earley::parse_grammar(text, false);
+  Grammar built(start, grammar, terminals);
+  time_sets(path, built.start(), built.all_rules());
+
+  std::mt19937 random(1);
+  for (int nonterminals: {1000, 10000, 50000})
+  {
+    auto rules = random_grammar(nonterminals, random);
+    time_sets("random", 0, rules);
+  }
+
+  return 0;
+}
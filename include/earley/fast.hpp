@@ -1,20 +1,31 @@
 #ifndef EARLEY_FAST_HPP_INCLUDED
 #define EARLEY_FAST_HPP_INCLUDED
 
-#include <deque>
+#include <algorithm>
 #include <memory>
+#include <memory_resource>
+#include <optional>
+#include <shared_mutex>
 #include <vector>
 
 #include "earley.hpp"
 #include "earley_hash_set.hpp"
 
 #include "earley/grammar_util.hpp"
+#include "earley/pool.hpp"
 #include "earley/stack.hpp"
 
+#include "earley/fast/compiled.hpp"
 #include "earley/fast/grammar.hpp"
 #include "earley/fast/items.hpp"
+#include "earley/fast/membership.hpp"
+#include "earley/fast/range.hpp"
 
-#define MAX_LOOKAHEAD_SETS 4
+// The number of goto sets kept for each (set, token, lookahead) starts at
+// the first, and doubles up to the second for the keys where the sets are
+// evicted more often than they are used.
+#define INITIAL_GOTO_WAYS 2
+#define MAX_GOTO_WAYS 8
 
 namespace earley
 {
@@ -27,46 +38,14 @@ namespace earley
 
     typedef std::vector<size_t> TerminalList;
 
-    // TODO: move this to a utility class
-    template <typename T>
-    class Range
-    {
-      public:
-      Range(T b, T e)
-      : m_begin(b)
-      , m_end(e)
-      {
-      }
-
-      T
-      begin() const
-      {
-        return m_begin;
-      }
-
-      T
-      end() const
-      {
-        return m_end;
-      }
-
-      auto
-      operator[](int i) const
-      {
-        return *(m_begin + i);
-      }
-
-      private:
-      T m_begin;
-      T m_end;
-    };
-
-    template <typename T>
-    Range<T>
-    make_range(T begin, T end)
-    {
-      return Range(begin, end);
-    }
+    // How the parser's hash tables probe. Building with
+    // EARLEY_GROUP_PROBING switches all of them to GroupProbing, so that
+    // the two can be compared on real parses, see test/hash_timer.cpp.
+#ifdef EARLEY_GROUP_PROBING
+    typedef GroupProbing TableProbing;
+#else
+    typedef DoubleHashing TableProbing;
+#endif
 
     inline
     auto
@@ -110,15 +89,55 @@ namespace earley
       return s.index;
     }
 
+    // The memory that item set cores are built in.
+    // Each stack has a single current contiguous sequence, so two cores can
+    // only be built at the same time if they each have their own arenas.
+    struct CoreArenas
+    {
+      CoreArenas(std::pmr::memory_resource* resource =
+        std::pmr::get_default_resource())
+      : items(resource)
+      , parents(resource)
+      {
+      }
+
+      Stack<const Item*> items;
+      Stack<int> parents;
+    };
+
+    // The memory that the item sets of one parse are built in.
+    struct ParseArenas
+    {
+      ParseArenas(std::pmr::memory_resource* resource =
+        std::pmr::get_default_resource())
+      : cores(resource)
+      , distances(resource)
+      {
+      }
+
+      CoreArenas cores;
+      Stack<int> distances;
+    };
+
     class ItemSetCore
     {
       public:
 
-      ItemSetCore()
+      // The items in `items` from `begin` to `end` have `symbol` after the
+      // dot, see transition_key.
+      struct Transition
+      {
+        int symbol;
+        uint32_t begin;
+        uint32_t end;
+      };
+
+      ItemSetCore(CoreArenas& arenas)
+      : m_arenas(&arenas)
       {
         //m_parent_indexes.reserve(4);
-        m_parent_list_end = m_parent_list = parent_stack.start();
-        m_item_list_end = m_item_list = item_stack.start();
+        m_parent_list_end = m_parent_list = m_arenas->parents.start();
+        m_item_list_end = m_item_list = m_arenas->items.start();
       }
 
       void
@@ -159,8 +178,8 @@ namespace earley
       {
         insert_item(item);
         //m_parent_indexes.push_back(parent);
-        m_parent_list = parent_stack.emplace_back(parent);
-        m_parent_list_end = m_parent_list + parent_stack.top_size();
+        m_parent_list = m_arenas->parents.emplace_back(parent);
+        m_parent_list_end = m_parent_list + m_arenas->parents.top_size();
       }
 
       void
@@ -227,10 +246,10 @@ namespace earley
         m_start_items = 0;
         m_hash = 0;
 
-        item_stack.destroy_top();
+        m_arenas->items.destroy_top();
         m_item_list_end = m_item_list;
 
-        parent_stack.destroy_top();
+        m_arenas->parents.destroy_top();
         m_parent_list_end = m_parent_list;
 
         ++m_resets;
@@ -240,29 +259,72 @@ namespace earley
       void
       finalise()
       {
-        item_stack.finalise();
-        parent_stack.finalise();
+        m_arenas->items.finalise();
+        m_arenas->parents.finalise();
+      }
+
+      // The transitions, sorted by symbol, and the item indexes that they
+      // are ranges of.
+      void
+      set_transitions(const Transition* transitions, size_t count,
+        const uint16_t* items)
+      {
+        m_transitions = transitions;
+        m_transition_count = count;
+        m_transition_items = items;
+      }
+
+      // The indexes of the items with `symbol` after the dot. Only an
+      // interned core has any.
+      Range<const uint16_t*>
+      transitions(grammar::Symbol symbol) const
+      {
+        auto key = transition_key(symbol);
+        auto end = m_transitions + m_transition_count;
+        auto found = std::lower_bound(m_transitions, end, key,
+          [](const Transition& transition, int key) {
+            return transition.symbol < key;
+          });
+
+        if (found == end || found->symbol != key)
+        {
+          return Range<const uint16_t*>(nullptr, nullptr);
+        }
+
+        return Range<const uint16_t*>(m_transition_items + found->begin,
+          m_transition_items + found->end);
+      }
+
+      // Terminals and nonterminals are interleaved.
+      static
+      int
+      transition_key(grammar::Symbol symbol)
+      {
+        return symbol.index * 2 + symbol.terminal;
       }
 
       private:
       void
       insert_item(const Item* item)
       {
-        m_item_list = item_stack.emplace_back(item);
-        m_item_list_end = m_item_list + item_stack.top_size();
+        m_item_list = m_arenas->items.emplace_back(item);
+        m_item_list_end = m_item_list + m_arenas->items.top_size();
       }
 
+      CoreArenas* m_arenas;
       size_t m_start_items = 0;
       size_t m_hash = 0;
       //std::vector<size_t> m_parent_indexes;
 
       int* m_parent_list = nullptr;
       int *m_parent_list_end = nullptr;
-      static Stack<int> parent_stack;
 
       const Item** m_item_list = nullptr;
       const Item** m_item_list_end = nullptr;
-      static Stack<const Item*> item_stack;
+
+      const Transition* m_transitions = nullptr;
+      size_t m_transition_count = 0;
+      const uint16_t* m_transition_items = nullptr;
 
       int m_number;
       int m_resets = 0;
@@ -390,9 +452,10 @@ namespace earley
     {
       public:
 
-      ItemSet(ItemSetCore* core)
+      ItemSet(ItemSetCore* core, ParseArenas& arenas)
       : m_core(core)
-      , m_distances(distance_stack)
+      , m_arenas(&arenas)
+      , m_distances(arenas.distances)
       {
         //m_distances.reserve(10);
         //m_distances = distance_stack.start();
@@ -485,27 +548,29 @@ namespace earley
       void
       print(const std::unordered_map<size_t, std::string>& names) const;
 
+      // Reuse a set that turned out to be a duplicate. Its distances were
+      // replaced by the existing ones, so start a new sequence for them.
       void
       reset(ItemSetCore* core)
       {
         m_core = core;
         m_hash = 0;
-        m_distances.reset();
+        m_distances = StackDistances(m_arenas->distances);
       }
 
       void
       set_distance(const StackDistances& d)
       {
-        distance_stack.destroy_top();
+        m_arenas->distances.destroy_top();
         m_distances = d;
       }
 
       private:
       ItemSetCore* m_core;
+      ParseArenas* m_arenas;
       size_t m_hash = 0;
 
       StackDistances m_distances;
-      static Stack<int> distance_stack;
     };
 
     class ItemSetOwner
@@ -604,10 +669,31 @@ namespace earley
       int symbol;
       int lookahead;
 
-      ItemSet* goto_sets[MAX_LOOKAHEAD_SETS];
-      int place[MAX_LOOKAHEAD_SETS] = {0};
-      int goto_position = 0;
-      int goto_count = 0;
+      struct Goto
+      {
+        ItemSet* set;
+        int place;
+        uint32_t epoch;
+      };
+
+      // The most recently used is first.
+      Goto gotos[MAX_GOTO_WAYS];
+      uint8_t count = 0;
+      uint8_t ways = INITIAL_GOTO_WAYS;
+
+      // Since the ways last changed.
+      uint16_t hits = 0;
+      uint16_t evictions = 0;
+    };
+
+    struct GotoStats
+    {
+      size_t hits = 0;
+      size_t misses = 0;
+      size_t evictions = 0;
+
+      // The number of times a key was given more ways.
+      size_t grown = 0;
     };
 
     inline
@@ -632,42 +718,231 @@ namespace earley
       return !operator==(lhs, rhs);
     }
 
-    struct ItemTreePointers
+    class LazyForest;
+    class Parser;
+
+    // The shared packed parse forest of a successful parse, in flat arrays.
+    //
+    // A node covers the tokens from `start` to `end`. A symbol node is a
+    // terminal or a nonterminal over them, and an intermediate node is the
+    // symbols before the dot of an item, when there are at least two. Each
+    // packed node under a node is one way of deriving it: `item` is the
+    // item with the dot after the last symbol, `right` is the node of that
+    // symbol and `left` the node of the symbols before it. That is a symbol
+    // node when there is only one symbol before it, and no_node when there
+    // are none, so an empty rule has a packed node with neither. A terminal
+    // node has no packed nodes.
+    //
+    // Nodes are numbered from zero in the order that they are found from the
+    // root, and only the nodes under the root are made. The packed nodes of
+    // a node are next to each other in one array.
+    class Forest
     {
-      ItemTreePointers(
-        const Item* _source,
-        const ItemSet* _from,
-        size_t _label
-      )
-      : source(_source)
-      , from(_from)
-      , label(_label)
+      public:
+      typedef uint32_t Node;
+
+      static constexpr Node no_node = ~Node(0);
+
+      enum class Kind
       {
+        terminal,
+        nonterminal,
+        intermediate,
+      };
+
+      struct Packed
+      {
+        const Item* item;
+        Node left;
+        Node right;
+      };
+
+      Forest(std::pmr::memory_resource* resource =
+        std::pmr::get_default_resource());
+
+      // Build the forest of the `end` tokens that `parser` has parsed.
+      void
+      build(const Parser& parser, size_t end);
+
+      void
+      clear();
+
+      // The node of the start symbol over the whole input, or no_node if
+      // the input isn't a sentence.
+      Node
+      root() const
+      {
+        return m_root;
+      }
+
+      std::optional<Node>
+      find(grammar::Symbol symbol, size_t start, size_t end) const;
+
+      std::optional<Node>
+      find(const Item* item, size_t start, size_t end) const;
+
+      Kind
+      kind(Node node) const
+      {
+        auto& data = m_nodes[node];
+        return data.item != nullptr ? Kind::intermediate
+          : data.symbol.terminal ? Kind::terminal
+          : Kind::nonterminal;
+      }
+
+      // The symbol of a symbol node, or the nonterminal of the item's rule
+      // for an intermediate node.
+      grammar::Symbol
+      symbol(Node node) const
+      {
+        return m_nodes[node].symbol;
+      }
+
+      // The item of an intermediate node, or null for a symbol node.
+      const Item*
+      item(Node node) const
+      {
+        return m_nodes[node].item;
+      }
+
+      size_t
+      start(Node node) const
+      {
+        return m_nodes[node].start;
+      }
+
+      size_t
+      end(Node node) const
+      {
+        return m_nodes[node].end;
+      }
+
+      Range<const Packed*>
+      packed(Node node) const
+      {
+        return Range<const Packed*>(
+          m_packed.data() + m_offsets[node],
+          m_packed.data() + m_offsets[node + 1]);
+      }
+
+      size_t
+      nodes() const
+      {
+        return m_nodes.size();
       }
 
-      const Item* source;
-      const ItemSet* from;
-      size_t label;
+      size_t
+      packed_nodes() const
+      {
+        return m_packed.size();
+      }
+
+      private:
+      struct NodeKey
+      {
+        const Item* item;
+        grammar::Symbol symbol;
+        uint32_t start;
+        uint32_t end;
+
+        bool
+        operator==(const NodeKey& rhs) const
+        {
+          return item == rhs.item && symbol == rhs.symbol &&
+            start == rhs.start && end == rhs.end;
+        }
+      };
+
+      struct NodeKeyHash
+      {
+        size_t
+        operator()(const NodeKey& key) const
+        {
+          size_t hash = std::hash<const Item*>()(key.item);
+          hash_combine(hash, std::hash<grammar::Symbol>()(key.symbol));
+          hash_combine(hash, key.start);
+          hash_combine(hash, key.end);
+          return hash;
+        }
+      };
+
+      // Returns the node, adding it if it isn't there yet.
+      Node
+      add_node(const Item* item, grammar::Symbol symbol, size_t start,
+        size_t end);
+
+      // The node of the symbols before the dot of `item`, see Packed.
+      Node
+      prefix(const Item* item, size_t start, size_t end);
+
+      // Add a packed node for each way that `item` derives the tokens from
+      // `start` to `end`.
+      void
+      add_derivations(LazyForest& reductions, const Item* item, size_t start,
+        size_t end);
+
+      std::pmr::memory_resource* m_resource;
+      std::pmr::vector<NodeKey> m_nodes;
+      HashMap<NodeKey, Node, NodeKeyHash> m_node_ids;
 
-      template <typename T>
-      using Container = HashSet<T>;
+      // The packed nodes of node n are from m_offsets[n] to m_offsets[n+1].
+      std::pmr::vector<uint32_t> m_offsets;
+      std::pmr::vector<Packed> m_packed;
+
+      Node m_root = no_node;
+    };
 
-      using LabelledItem = std::tuple<const Item*, size_t>;
+    class StaleCheckpoint {};
 
-      Container<LabelledItem> reduction;
-      Container<LabelledItem> predecessor;
+    // Where a parse failed. The set is the last one that could be made, so
+    // it has everything that was expected at that position.
+    struct ParseError
+    {
+      size_t position;
+      const ItemSet* set;
     };
 
     class Parser
     {
       public:
-      typedef HashMap<SetSymbolRules, std::vector<uint16_t>> SetSymbolHash;
-      typedef HashSet<SetTermLookahead> SetTermLookaheadHash;
-      typedef HashSet<ItemTreePointers> ItemTreeHash;
-      typedef HashSet<StackDistances, StackDistanceHash, StackDistanceEq>
-        DistanceHash;
-
-      Parser(const grammar::Grammar&, const TerminalList&);
+      typedef HashSet<SetTermLookahead, std::hash<SetTermLookahead>,
+        std::equal_to<SetTermLookahead>, TableProbing> SetTermLookaheadHash;
+      typedef HashSet<StackDistances, StackDistanceHash, StackDistanceEq,
+        TableProbing> DistanceHash;
+      typedef HashSet<ItemSetOwner, std::hash<ItemSetOwner>,
+        std::equal_to<ItemSetOwner>, TableProbing> ItemSetHash;
+
+      // Everything that belongs to one parse is allocated from `resource`,
+      // which must outlive the parser. A monotonic buffer for each parse
+      // can be released all at once afterwards. The cores are shared with
+      // other parses, so they are not allocated from it.
+
+      // Borrows the compiled grammar, which must outlive the parser.
+      Parser(const CompiledGrammar&, const TerminalList&,
+        std::pmr::memory_resource* resource =
+          std::pmr::get_default_resource());
+
+      // Shares ownership of the compiled grammar.
+      Parser(std::shared_ptr<const CompiledGrammar>, const TerminalList&,
+        std::pmr::memory_resource* resource =
+          std::pmr::get_default_resource());
+
+      // Compiles a private copy of the grammar. Prefer one of the above when
+      // more than one input is parsed with the same grammar.
+      Parser(const grammar::Grammar&, const TerminalList&,
+        std::pmr::memory_resource* resource =
+          std::pmr::get_default_resource());
+
+      // A parser without any input yet, the tokens are given to it one at
+      // a time with `feed`.
+      Parser(const CompiledGrammar&, std::pmr::memory_resource* resource =
+        std::pmr::get_default_resource());
+      Parser(std::shared_ptr<const CompiledGrammar>,
+        std::pmr::memory_resource* resource =
+          std::pmr::get_default_resource());
+
+      // The item sets point into this parser's arenas.
+      Parser(const Parser&) = delete;
 
       void
       parse_input();
@@ -675,73 +950,129 @@ namespace earley
       void
       parse(size_t position);
 
+      // Parse the next token of a streamed input. A token is only parsed
+      // when the one after it arrives, since that is its lookahead.
       void
-      print_set(size_t i);
-
-      void
-      print_stats() const;
-
-      void
-      create_reductions();
-
-      private:
+      feed(size_t token);
 
-      void
-      create_all_items();
+      // The end of a streamed input. Parses the last token and returns
+      // whether the whole input is in the language.
+      bool
+      finish();
 
-      void
-      create_start_set();
+      // Parse the rest of the input without printing anything when it fails.
+      // Returns where it failed, or nothing if the input is in the language.
+      // The parser can still be used after a failure, such as by a rollback
+      // or a reparse. This is for input given up front, a streamed input
+      // throws std::logic_error.
+      std::optional<ParseError>
+      recognise();
 
-      const Item*
-      get_item(const grammar::Rule* rule, int dot);
+      // The terminals that would have been accepted where `error` failed.
+      std::vector<size_t>
+      expected(const ParseError& error) const;
 
       void
-      expand_set(ItemSet* items);
+      print_error(const ParseError& error, std::ostream& out) const;
+
+      // Parse again after the tokens from `begin` to `end` of the input have
+      // been replaced, `tokens` is the whole of the new input. Only the sets
+      // from `begin` are parsed again, and it stops as soon as the new sets
+      // line up with the old ones after the edit. This is for input given
+      // up front, a streamed input throws std::logic_error.
+      //
+      // Distances are relative, so when the edit changes the number of
+      // tokens, an item that started before the edit points at a different
+      // set afterwards. Such items stop the sets from lining up, so on a
+      // list at the top level, such as `S: S '+' x`, an insert or a delete
+      // parses again up to the end of the input. Only an edit that keeps
+      // the number of tokens stops early there.
+      // Returns the number of tokens that were parsed again.
+      size_t
+      reparse(size_t begin, size_t end, const TerminalList& tokens);
 
-      void
-      add_empty_symbol_items(ItemSet* items);
+      // The state of a parse that can be returned to later. Sets are never
+      // changed once they are made, so this is only how far the parse got.
+      struct Checkpoint
+      {
+        size_t sets;
+        size_t epoch;
+        std::optional<size_t> pending;
+      };
 
-      void
-      add_non_start_items(ItemSet* items);
+      Checkpoint
+      checkpoint() const;
 
+      // Throw away everything parsed since `checkpoint`. Throws
+      // StaleCheckpoint if the parser has since rolled back, or reparsed,
+      // to before it.
       void
-      add_initial_item(ItemSetCore*, const PItem* item);
+      rollback(const Checkpoint& checkpoint);
 
-      void
-      item_transition(ItemSet* items, const PItem* item, size_t i);
+      // Whether the input is a complete sentence. This only makes sense
+      // after the last token, since items are filtered on the lookahead.
+      bool
+      accepted() const;
 
       void
-      item_completion(ItemSet*, const PItem*, size_t i);
+      print_set(size_t i);
 
       void
-      insert_transitions(ItemSetCore*, const Entry& symbol, size_t);
+      print_stats() const;
 
+      // Build the forest of a successful parse.
       void
-      insert_transitions(ItemSetCore*, const grammar::Symbol&, size_t);
+      create_reductions();
 
-      SetSymbolHash::iterator
-      new_symbol_index(const SetSymbolRules& item)
+      const Forest&
+      forest() const
       {
-        return m_set_symbols.emplace(item).first;
+        return m_forest;
       }
 
-      ItemSet*
-      create_new_set(size_t position, const TerminalList& input);
+      // The set after `position` tokens.
+      const ItemSet*
+      set(size_t position) const
+      {
+        return m_itemSets[position];
+      }
 
-      bool
-      nullable(const Entry& symbol)
+      const CompiledGrammar&
+      grammar() const
       {
-        return symbol.empty();
+        return m_grammar;
       }
 
-      bool
-      nullable(const grammar::Symbol& symbol)
+      const GotoStats&
+      goto_stats() const
       {
-        return !symbol.terminal && m_grammar_new.nullable(symbol.index);
+        return m_goto_stats;
       }
 
+      private:
+
+      Parser(const CompiledGrammar&, const TerminalList*,
+        std::pmr::memory_resource*);
+
+      // Parse `token`, at `position`. The lookahead is END_OF_INPUT for
+      // the last token.
+      // Returns false if `token` can't be parsed at `position`.
+      bool
+      advance(size_t position, size_t token, int lookahead);
+
+      void
+      create_start_set();
+
+      const Item*
+      get_item(const grammar::Rule* rule, int dot);
+
+      ItemSet*
+      create_new_set(size_t position, size_t token, int lookahead);
+
+      // Print the error and throw.
+      [[noreturn]]
       void
-      parse_error(size_t);
+      fail(size_t position, size_t token);
 
       bool
       item_in_set(const ItemSet* set, const Item* item, int distance,
@@ -751,63 +1082,66 @@ namespace earley
       unique_insert_start_item(
         ItemSet* set,
         const Item* item,
-        int distance,
-        int position
+        int distance
       );
 
-      ItemSetCore&
-      next_core();
-
       ItemSet&
       next_set(ItemSetCore* core);
 
       void
       reset_set();
 
-      grammar::Grammar m_grammar_new;
-      const TerminalList& m_tokens;
+      void
+      push_set(ItemSet* set);
 
-      std::vector<ItemSet*> m_itemSets;
-      HashSet<ItemSetOwner> m_item_set_hash;
-      HashSet<ItemSetCore*, CoreHash, CoreEqual> m_set_core_hash;
-      //std::deque<ItemSet> m_setOwner;
-      //std::deque<ItemSetCore> m_coreOwner;
+      void
+      truncate_sets(size_t size);
 
-      std::vector<ItemSet> m_setOwner;
-      std::vector<ItemSetCore> m_coreOwner;
+      // Whether a goto set made at `place` in `epoch` came from the sets
+      // that are there now.
+      bool
+      current_place(size_t place, size_t epoch) const;
 
-      bool m_core_reset = false;
-      bool m_set_reset = false;
+      std::shared_ptr<const CompiledGrammar> m_grammar_owner;
+      const CompiledGrammar& m_grammar;
 
-      SetSymbolHash m_set_symbols;
-      SetTermLookaheadHash m_set_term_lookahead;
-      ItemTreeHash m_item_tree;
-      DistanceHash m_distance_hash;
+      // This is null for a streamed input.
+      const TerminalList* m_tokens;
 
-      std::vector<bool> m_nullable;
+      // The streamed token waiting for its lookahead.
+      std::optional<size_t> m_pending;
 
-      // follow and first sets
-      FirstSet m_first_sets;
-      FollowSet m_follow_sets;
+      // Everything the parser allocates comes from here.
+      std::pmr::memory_resource* m_resource;
 
-      Items m_all_items;
+      // Declared before the sets so that it outlives them.
+      ParseArenas m_arenas;
 
-      std::vector<std::vector<size_t>> m_item_membership;
+      std::pmr::vector<ItemSet*> m_itemSets;
+      ItemSetHash m_item_set_hash;
 
-      int m_lookahead_collisions = 0;
-      int m_reuse = 0;
+      // The sets never move, and the pool only grows with the number of
+      // unique sets, which is far fewer than the number of tokens.
+      BlockPool<ItemSet> m_setOwner;
 
-      auto
-      insert_transition(const SetSymbolRules& tuple)
-      -> decltype(m_set_symbols.emplace(tuple));
-    };
+      // The start items of each new set are collected here, then it is
+      // swapped for the shared core with the same start items.
+      ItemSetCore m_scratch_core;
 
-    inline
-    bool
-    operator==(const ItemTreePointers& lhs, const ItemTreePointers& rhs)
-    {
-      return lhs.source == rhs.source;
-    }
+      bool m_set_reset = false;
+
+      SetTermLookaheadHash m_set_term_lookahead;
+      Forest m_forest;
+      DistanceHash m_distance_hash;
+
+      Membership m_membership;
+
+      // Which truncation of the sets each set was added after.
+      std::pmr::vector<size_t> m_set_epochs;
+      size_t m_epoch = 0;
+
+      GotoStats m_goto_stats;
+    };
 
     struct CoreHash
     {
@@ -832,6 +1166,168 @@ namespace earley
         ;
       }
     };
+
+    // Item set cores, and the transitions out of them, only depend on the
+    // grammar. This keeps every core that has been needed so far, so that
+    // parses after the first one rarely have to expand a core at all.
+    //
+    // Each compiled grammar has one of these. Looking up cores takes a
+    // shared lock, only adding a core takes the exclusive lock. The
+    // transitions are in the cores, which never change once they are
+    // interned, so they don't need a lock.
+    class CoreCache
+    {
+      public:
+      typedef Range<const uint16_t*> Transitions;
+      typedef HashSet<ItemSetCore*, CoreHash, CoreEqual, TableProbing>
+        CoreHashSet;
+
+      CoreCache(const CompiledGrammar& grammar);
+
+      // Returns the core with the same start items as `core`, expanding
+      // and keeping a copy of `core` if there isn't one yet.
+      // The core returned is finalised and must not be changed.
+      ItemSetCore*
+      intern(const ItemSetCore& core);
+
+      // The indexes of the items in `core` with `symbol` after the dot.
+      // This is empty if there are none.
+      Transitions
+      transitions(const ItemSetCore* core, grammar::Symbol symbol) const;
+
+      size_t
+      size() const;
+
+      private:
+
+      void
+      expand(ItemSetCore* core);
+
+      void
+      add_empty_symbol_items(ItemSetCore* core);
+
+      void
+      add_non_start_items(ItemSetCore* core);
+
+      void
+      add_initial_item(ItemSetCore*, const PItem* item);
+
+      void
+      add_predictions(ItemSetCore* core, int nonterminal);
+
+      void
+      item_transition(ItemSetCore* core, const PItem* item, size_t i);
+
+      void
+      insert_transitions(ItemSetCore*, const grammar::Symbol&, size_t);
+
+      void
+      build_transitions(ItemSetCore* core);
+
+      bool
+      nullable(const grammar::Symbol& symbol) const;
+
+      const CompiledGrammar& m_grammar;
+      mutable std::shared_mutex m_mutex;
+
+      // Declared before the cores so that they outlive them.
+      CoreArenas m_arenas;
+      Stack<ItemSetCore::Transition> m_transition_ranges;
+      Stack<uint16_t> m_transition_items;
+
+      BlockPool<ItemSetCore> m_cores;
+      CoreHashSet m_core_hash;
+
+      // The (symbol key, item index) pairs of the core being expanded.
+      std::vector<std::pair<int, uint16_t>> m_scratch_transitions;
+
+      // The items and the predicted nonterminals of the core being
+      // expanded are stamped with m_stamp. Only used with the exclusive lock.
+      std::vector<size_t> m_item_stamps;
+      std::vector<size_t> m_predicted;
+      size_t m_stamp = 0;
+    };
+
+    // The reductions of a parse, worked out for a node only when it is first
+    // visited, and then remembered.
+    //
+    // Unlike Forest, a node is at a position rather than in a unique set: a
+    // completed or partly completed item, the position it ends at, and the
+    // distance back to where it started. The reductions of a node are the
+    // completed items for the symbol before its dot, that end at the same
+    // position, and where the item with the dot moved back is in the set
+    // that they start in.
+    class LazyForest
+    {
+      public:
+
+      struct Reduction
+      {
+        const Item* item;
+        int distance;
+      };
+
+      typedef Range<const Reduction*> Reductions;
+
+      LazyForest(const Parser& parser, std::pmr::memory_resource* resource =
+        std::pmr::get_default_resource());
+
+      Reductions
+      reductions(const Item* item, size_t position, int distance);
+
+      // The items of a core that complete a nonterminal. They stay put
+      // while more are looked up.
+      Range<const uint16_t*>
+      completed(const ItemSetCore* core, int nonterminal);
+
+      // The number of nodes that have been visited.
+      size_t
+      nodes() const
+      {
+        return m_nodes.size();
+      }
+
+      private:
+      struct NodeKey
+      {
+        const Item* item;
+        size_t position;
+        int distance;
+
+        bool
+        operator==(const NodeKey& rhs) const
+        {
+          return item == rhs.item && position == rhs.position &&
+            distance == rhs.distance;
+        }
+      };
+
+      struct NodeKeyHash
+      {
+        size_t
+        operator()(const NodeKey& key) const
+        {
+          size_t hash = std::hash<const Item*>()(key.item);
+          hash_combine(hash, key.position);
+          hash_combine(hash, key.distance);
+          return hash;
+        }
+      };
+
+      bool
+      in_set(const Item* item, size_t position, int distance);
+
+      const Parser& m_parser;
+      const CompiledGrammar& m_grammar;
+
+      // Each node's reductions are a finalised sequence in the stack, so
+      // they stay put while more nodes are visited.
+      HashMap<NodeKey, Reductions, NodeKeyHash> m_nodes;
+      Stack<Reduction> m_reductions;
+
+      HashMap<SetSymbolRules, Range<const uint16_t*>> m_completed;
+      Stack<uint16_t> m_completed_items;
+    };
   }
 }
 
@@ -885,17 +1381,6 @@ namespace std
       return s.get().hash();
     }
   };
-
-  template <>
-  struct hash<earley::fast::ItemTreePointers>
-  {
-    size_t
-    operator()(const earley::fast::ItemTreePointers& s) const
-    {
-      std::hash<decltype(s.source)> h;
-      return h(s.source);
-    }
-  };
 }
 
 #endif
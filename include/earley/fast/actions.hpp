@@ -0,0 +1,341 @@
+#ifndef EARLEY_FAST_ACTIONS_HPP_INCLUDED
+#define EARLEY_FAST_ACTIONS_HPP_INCLUDED
+
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "earley/fast.hpp"
+
+namespace earley::fast
+{
+  // Runs the rule actions over a successful parse.
+  //
+  // A completed item is identified by the position that it ends at and its
+  // distance back to where it started. The symbols before its dot are
+  // visited right to left: a terminal is the token before the position, and
+  // a nonterminal is one of the item's reductions in a LazyForest, so only
+  // the nodes on the way to a value are worked out. The values are then
+  // passed to the rule's action.
+  //
+  // Terminals are given to the actions as the token id when the result can
+  // hold a size_t. Otherwise they are given as a char, like the other
+  // parser, and a token id that doesn't fit in one throws
+  // std::out_of_range.
+  template <typename Actions>
+  class ActionRunner
+  {
+    public:
+    using Result = typename ActionType<Actions>::type;
+
+    ActionRunner(const Parser& parser, const TerminalList& tokens,
+      const Actions& actions)
+    : m_parser(parser)
+    , m_grammar(parser.grammar())
+    , m_tokens(tokens)
+    , m_actions(actions)
+    , m_forest(parser)
+    {
+    }
+
+    // The value of the start symbol for the whole input.
+    Result
+    run()
+    {
+      auto position = m_tokens.size();
+      auto set = m_parser.set(position);
+      auto core = set->core();
+
+      for (size_t i = 0; i != core->all_items(); ++i)
+      {
+        auto item = core->item(i);
+        if (item->nonterminal() == m_grammar.start() &&
+          item->complete() &&
+          set->actual_distance(i) == position)
+        {
+          // The start rule is the real start symbol, and has no action.
+          m_results.clear();
+          if (item_values(item, position, position))
+          {
+            return m_results.front();
+          }
+        }
+      }
+
+      return values::Failed();
+    }
+
+    private:
+
+    using Reduction = LazyForest::Reduction;
+
+    // Where a frame is up to. A frame that finds the values of the symbols
+    // before the dot starts at `start`, and one that runs the action of a
+    // complete item starts at `action`.
+    enum class Step
+    {
+      start,
+      terminal,
+      next_reduction,
+      reduction_values,
+      reduction_action,
+      action,
+      action_values,
+    };
+
+    struct Frame
+    {
+      Step step;
+      const Item* item;
+      size_t position;
+      int distance;
+
+      // The size of the results when the frame started.
+      size_t size = 0;
+
+      // The reductions left to try for a nonterminal before the dot.
+      const Reduction* reduction = nullptr;
+      const Reduction* reductions_end = nullptr;
+    };
+
+    struct Key
+    {
+      const Item* item;
+      size_t position;
+      int distance;
+
+      bool
+      operator==(const Key& rhs) const
+      {
+        return item == rhs.item && position == rhs.position &&
+          distance == rhs.distance;
+      }
+    };
+
+    struct KeyHash
+    {
+      size_t
+      operator()(const Key& key) const
+      {
+        size_t hash = std::hash<const Item*>()(key.item);
+        hash_combine(hash, key.position);
+        hash_combine(hash, key.distance);
+        return hash;
+      }
+    };
+
+    // Push the values of the symbols before the dot of `item` onto the
+    // results, from left to right.
+    // Returns false if there is no way to derive them.
+    //
+    // A left recursive rule nests once for each token, so this keeps its
+    // own stack of frames instead of recursing. A frame that finishes pops
+    // itself and leaves what it found in `derived` or `value` for the frame
+    // under it.
+    bool
+    item_values(const Item* item, size_t position, int distance)
+    {
+      m_frames.clear();
+      m_frames.push_back(Frame{Step::start, item, position, distance});
+
+      bool derived = false;
+      Result value = values::Failed();
+
+      while (!m_frames.empty())
+      {
+        auto& frame = m_frames.back();
+
+        switch (frame.step)
+        {
+          case Step::start:
+          {
+            auto& rule = frame.item->rule();
+            if (frame.item->dot() == rule.begin())
+            {
+              derived = frame.distance == 0;
+              m_frames.pop_back();
+              break;
+            }
+
+            auto previous = frame.item->previous();
+            if ((frame.item->dot() - 1)->terminal)
+            {
+              if (frame.distance == 0)
+              {
+                derived = false;
+                m_frames.pop_back();
+                break;
+              }
+
+              frame.step = Step::terminal;
+              m_frames.push_back(Frame{Step::start, previous,
+                frame.position - 1, frame.distance - 1});
+              break;
+            }
+
+            auto reductions = m_forest.reductions(frame.item, frame.position,
+              frame.distance);
+            frame.size = m_results.size();
+            frame.reduction = reductions.begin();
+            frame.reductions_end = reductions.end();
+            frame.step = Step::next_reduction;
+            break;
+          }
+
+          case Step::terminal:
+          if (derived)
+          {
+            m_results.push_back(terminal(m_tokens[frame.position - 1]));
+          }
+          m_frames.pop_back();
+          break;
+
+          case Step::next_reduction:
+          if (frame.reduction == frame.reductions_end)
+          {
+            derived = false;
+            m_frames.pop_back();
+          }
+          else
+          {
+            frame.step = Step::reduction_values;
+            m_frames.push_back(Frame{Step::start, frame.item->previous(),
+              frame.position - frame.reduction->distance,
+              frame.distance - frame.reduction->distance});
+          }
+          break;
+
+          case Step::reduction_values:
+          if (derived)
+          {
+            frame.step = Step::reduction_action;
+            m_frames.push_back(Frame{Step::action, frame.reduction->item,
+              frame.position, frame.reduction->distance});
+          }
+          else
+          {
+            m_results.resize(frame.size, values::Failed());
+            ++frame.reduction;
+            frame.step = Step::next_reduction;
+          }
+          break;
+
+          case Step::reduction_action:
+          if (!holds<values::Failed>(value))
+          {
+            m_results.push_back(std::move(value));
+            derived = true;
+            m_frames.pop_back();
+          }
+          else
+          {
+            m_results.resize(frame.size, values::Failed());
+            ++frame.reduction;
+            frame.step = Step::next_reduction;
+          }
+          break;
+
+          case Step::action:
+          {
+            // An item that is already being run is a cycle.
+            Key key{frame.item, frame.position, frame.distance};
+            if (!m_visiting.insert(key).second)
+            {
+              value = values::Failed();
+              m_frames.pop_back();
+              break;
+            }
+
+            frame.size = m_results.size();
+            frame.step = Step::action_values;
+            m_frames.push_back(Frame{Step::start, frame.item, frame.position,
+              frame.distance});
+            break;
+          }
+
+          case Step::action_values:
+          m_visiting.erase(Key{frame.item, frame.position, frame.distance});
+          value = derived ? run_action(frame.item, frame.size)
+            : values::Failed();
+          m_results.resize(frame.size, values::Failed());
+          m_frames.pop_back();
+          break;
+        }
+      }
+
+      return derived;
+    }
+
+    Result
+    terminal(size_t token) const
+    {
+      if constexpr (std::is_constructible_v<Result,
+        std::in_place_type_t<size_t>, size_t>)
+      {
+        return Result(std::in_place_type<size_t>, token);
+      }
+      else
+      {
+        if (token > std::numeric_limits<unsigned char>::max())
+        {
+          throw std::out_of_range("token " + std::to_string(token) +
+            " doesn't fit in a char");
+        }
+
+        return static_cast<char>(token);
+      }
+    }
+
+    // Run the action of the complete `item` on the results from `begin`.
+    Result
+    run_action(const Item* item, size_t begin)
+    {
+      auto& action_runner = item->rule().actions();
+      auto iter = m_actions.find(get<0>(action_runner));
+      if (iter != m_actions.end() && iter->second)
+      {
+        std::vector<Result> run_actions;
+        for (auto& handle: get<1>(action_runner))
+        {
+          run_actions.push_back(m_results.at(begin + handle));
+        }
+
+        return iter->second(run_actions);
+      }
+      else
+      {
+        return values::Empty();
+      }
+    }
+
+    const Parser& m_parser;
+    const CompiledGrammar& m_grammar;
+    const TerminalList& m_tokens;
+    const Actions& m_actions;
+    LazyForest m_forest;
+
+    std::vector<Frame> m_frames;
+
+    // The values found so far, with the values of each item being run on
+    // top of those of the item that it is in.
+    std::vector<Result> m_results;
+
+    // The completed items that are being run, to stop at cycles.
+    std::unordered_set<Key, KeyHash> m_visiting;
+  };
+
+  template <typename Actions>
+  typename ActionType<Actions>::type
+  run_actions(const Parser& parser, const TerminalList& tokens,
+    const Actions& actions)
+  {
+    ActionRunner<Actions> runner(parser, tokens, actions);
+    return runner.run();
+  }
+}
+
+#endif
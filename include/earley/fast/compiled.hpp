@@ -0,0 +1,165 @@
+#ifndef EARLEY_FAST_COMPILED_HPP_INCLUDED
+#define EARLEY_FAST_COMPILED_HPP_INCLUDED
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "earley/fast/grammar.hpp"
+#include "earley/fast/items.hpp"
+#include "earley/fast/range.hpp"
+#include "earley/fast/tables.hpp"
+
+namespace earley::fast
+{
+  class CoreCache;
+
+  // A grammar together with everything the parser derives from it: the
+  // nullable, first and follow sets, and every item with its lookahead.
+  //
+  // It is never modified after construction, so it can be built once and
+  // shared by any number of parsers, on any number of threads. The one
+  // exception is the core cache, which does its own locking.
+  class CompiledGrammar
+  {
+    public:
+
+    CompiledGrammar(grammar::Grammar grammar);
+
+    // Loads a grammar that was compiled ahead of time, see generate.cpp.
+    // The admissible bitmap is used in place, so `tables` must outlive
+    // this.
+    CompiledGrammar(const GrammarTables& tables);
+    ~CompiledGrammar();
+
+    // The items point into the rules owned by this object.
+    CompiledGrammar(const CompiledGrammar&) = delete;
+
+    const grammar::Grammar&
+    grammar() const
+    {
+      return m_grammar;
+    }
+
+    const grammar::RuleList&
+    rules(int nonterminal) const
+    {
+      return m_grammar.rules(nonterminal);
+    }
+
+    bool
+    nullable(int nonterminal) const
+    {
+      return m_grammar.nullable(nonterminal);
+    }
+
+    int
+    start() const
+    {
+      return m_grammar.start();
+    }
+
+    auto&
+    names() const
+    {
+      return m_grammar.names();
+    }
+
+    const Item*
+    get_item(const grammar::Rule* rule, int dot) const
+    {
+      return m_items.get_item(rule, dot);
+    }
+
+    // The item numbered `index`.
+    const Item*
+    item(size_t index) const
+    {
+      return m_items.item(index);
+    }
+
+    // The number of items, items are numbered from zero to this.
+    size_t
+    items() const
+    {
+      return m_items.items();
+    }
+
+    // The terminals of the grammar are numbered below this.
+    size_t
+    terminals() const
+    {
+      return m_items.terminals();
+    }
+
+    // The items that can come before `terminal`, as a bitset indexed by the
+    // item's index. Every item can come before END_OF_INPUT.
+    const uint64_t*
+    admissible(int terminal) const
+    {
+      auto terminals = m_items.terminals();
+      size_t row;
+      if (terminal == grammar::END_OF_INPUT)
+      {
+        row = terminals;
+      }
+      else if (terminal < 0 || static_cast<size_t>(terminal) >= terminals)
+      {
+        row = terminals + 1;
+      }
+      else
+      {
+        row = terminal;
+      }
+
+      return m_items.admissible() + row * m_items.row_words();
+    }
+
+    static
+    bool
+    admits(const uint64_t* admissible, size_t item)
+    {
+      return (admissible[item / 64] >> (item % 64)) & 1;
+    }
+
+    // The items that predicting `nonterminal` adds to a core: the first item
+    // of each of its rules, everything those predict in turn, and the items
+    // after any nullable symbols. Each item is only in the list once.
+    Range<const Item* const*>
+    predictions(int nonterminal) const
+    {
+      return Range<const Item* const*>(
+        m_predictions.data() + m_prediction_offsets[nonterminal],
+        m_predictions.data() + m_prediction_offsets[nonterminal + 1]);
+    }
+
+    // The item set cores that parses with this grammar have built so far.
+    CoreCache&
+    cores() const
+    {
+      return *m_cores;
+    }
+
+    private:
+
+    void
+    build_predictions();
+
+    grammar::Grammar m_grammar;
+    Items m_items;
+    std::unique_ptr<CoreCache> m_cores;
+
+    // The predictions of nonterminal n are from m_prediction_offsets[n] to
+    // m_prediction_offsets[n+1].
+    std::vector<size_t> m_prediction_offsets;
+    std::vector<const Item*> m_predictions;
+  };
+
+  std::shared_ptr<const CompiledGrammar>
+  compile(grammar::Grammar grammar);
+
+  std::shared_ptr<const CompiledGrammar>
+  compile(const GrammarTables& tables);
+}
+
+#endif
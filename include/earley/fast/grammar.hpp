@@ -6,6 +6,11 @@
 #include "earley.hpp"
 #include "earley/grammar_util.hpp"
 
+namespace earley::fast
+{
+  struct GrammarTables;
+}
+
 namespace earley::fast::grammar
 {
   struct Symbol
@@ -66,9 +71,11 @@ namespace earley::fast::grammar
   {
     public:
 
-    Rule(int nonterminal, std::vector<Symbol> symbols)
+    Rule(int nonterminal, std::vector<Symbol> symbols,
+      ActionArgs actions = {})
     : m_nonterminal(nonterminal)
     , m_entries(std::move(symbols))
+    , m_actions(std::move(actions))
     {
       m_index = global_rule_counter++;
     }
@@ -97,6 +104,14 @@ namespace earley::fast::grammar
       return m_index;
     }
 
+    // The name of the action to run when this rule is reduced, and which
+    // of its symbols are passed to it.
+    const ActionArgs&
+    actions() const
+    {
+      return m_actions;
+    }
+
     private:
 
     int m_nonterminal;
@@ -158,23 +173,27 @@ namespace earley::fast::grammar
       TerminalIndices terminals = {}
     );
 
+    // A grammar that was compiled ahead of time. Its first and follow sets
+    // are empty, the tables already have everything that needs them.
+    Grammar(const GrammarTables& tables);
+
     const RuleList&
-    rules(const std::string& name);
+    rules(const std::string& name) const;
 
     const RuleList&
-    rules(int id)
+    rules(int id) const
     {
       return m_nonterminal_rules[id];
     }
 
     bool
-    nullable(int nonterminal)
+    nullable(int nonterminal) const
     {
       return m_nullable[nonterminal];
     }
 
     int
-    start()
+    start() const
     {
       return m_start;
     }
@@ -1,8 +1,10 @@
 #ifndef EARLEY_FAST_ITEMS_HPP_INCLUDED
 #define EARLEY_FAST_ITEMS_HPP_INCLUDED
 
+#include <cstdint>
 #include <exception>
 #include <memory>
+#include <vector>
 
 #include "earley/fast/grammar.hpp"
 
@@ -12,6 +14,9 @@ namespace earley::fast
   {
   };
 
+  // An item is a rule with a dot somewhere in it. Every item of a grammar
+  // is in one table, and the items of a rule are next to each other in the
+  // order of their dot, so moving the dot is a step to the next item.
   class Item
   {
     public:
@@ -20,30 +25,21 @@ namespace earley::fast
     (
       const grammar::Rule* rule,
       grammar::Rule::iterator position,
-      const HashSet<int>& lookahead,
-      bool empty = false,
-      size_t index = 0
+      bool empty,
+      size_t index
     )
     : m_rule(rule)
     , m_position(position)
     , m_empty_rhs(empty)
+    , m_complete(position == rule->end())
     , m_index(index)
     {
-      for (auto symbol : lookahead)
-      {
-        if (symbol == END_OF_INPUT)
-        {
-          //continue;
-        }
-
-        if (m_lookahead.size() <= static_cast<size_t>(symbol))
-        {
-          m_lookahead.resize(symbol+1);
-        }
-        m_lookahead[symbol] = true;
-      }
     }
 
+    // The items point at each other.
+    Item(const Item&) = delete;
+    Item(Item&&) = default;
+
     auto
     position() const
     {
@@ -80,12 +76,34 @@ namespace earley::fast
       return position() - m_rule->begin();
     }
 
+    // The dot is at the end.
+    bool
+    complete() const
+    {
+      return m_complete;
+    }
+
+    // The item with the dot after the next symbol. This item must not be
+    // complete.
+    const Item*
+    next() const
+    {
+      return this + 1;
+    }
+
+    // The item with the dot before the previous symbol. The dot must not be
+    // at the start.
+    const Item*
+    previous() const
+    {
+      return this - 1;
+    }
+
     bool
     in_lookahead(int symbol) const
     {
-      return 
-        (m_lookahead.size() > static_cast<size_t>(symbol) &&
-        m_lookahead[symbol]);
+      return symbol >= 0 && static_cast<size_t>(symbol) < m_terminals &&
+        ((m_lookahead[symbol * m_row_words] >> (m_index % 64)) & 1);
     }
 
     bool
@@ -105,42 +123,20 @@ namespace earley::fast
       const;
 
     private:
+    friend class Items;
+
     const grammar::Rule* m_rule;
     grammar::Rule::iterator m_position;
-    std::vector<bool> m_lookahead;
-    bool m_empty_rhs;
-    size_t m_index;
-  };
-
-  typedef std::vector<Item> ItemStore;
-
-  struct RuleItems
-  {
-    RuleItems(const grammar::Rule* _rule)
-    : rule(_rule)
-    {
-    }
 
-    const grammar::Rule* rule;
-    ItemStore items;
-  };
-
-  struct RuleItemHash
-  {
-    size_t
-    operator()(const RuleItems& ri)
-    {
-      return std::hash<decltype(ri.rule)>()(ri.rule);
-    }
-  };
+    // The word with this item's bit in the first row of the admissible
+    // bitmap in Items. The row of each terminal is `m_row_words` on.
+    const uint64_t* m_lookahead = nullptr;
+    size_t m_row_words = 0;
+    size_t m_terminals = 0;
 
-  struct RuleItemEq
-  {
-    bool
-    operator()(const RuleItems& lhs, const RuleItems& rhs)
-    {
-      return lhs.rule == rhs.rule;
-    }
+    bool m_empty_rhs;
+    bool m_complete;
+    size_t m_index;
   };
 
   class Items
@@ -151,49 +147,93 @@ namespace earley::fast
       const grammar::FollowSets&,
       const std::vector<bool>&);
 
+    // The items of a grammar that was built from `tables`. The lookahead is
+    // read from the tables where they are, so they must outlive this.
+    Items(const std::vector<grammar::RuleList>& rules,
+      const GrammarTables& tables);
+
+    // The items point into the table.
+    Items(const Items&) = delete;
+
     const Item*
-    get_item(const grammar::Rule* rule, int position)
+    get_item(const grammar::Rule* rule, int position) const
     {
-      auto store = find_rule(rule);
-      if (store == nullptr)
+      if (m_rule_items.size() <= rule->index() ||
+        m_rule_items[rule->index()] == no_items)
       {
         throw NoSuchItem();
       }
 
       auto length = rule->end() - rule->begin();
 
-      if (position > length)
+      if (position < 0 || position > length)
       {
         throw NoSuchItem();
       }
 
-      return &(*store)[position];
+      return &m_items[m_rule_items[rule->index()] + position];
+    }
+
+    // The item numbered `index`.
+    const Item*
+    item(size_t index) const
+    {
+      return &m_items[index];
     }
 
     size_t
     items() const
     {
-      return m_item_index;
+      return m_items.size();
+    }
+
+    // The terminals of the grammar are numbered below this.
+    size_t
+    terminals() const
+    {
+      return m_terminals;
+    }
+
+    // The number of words in a row of the admissible bitmap.
+    size_t
+    row_words() const
+    {
+      return m_row_words;
+    }
+
+    // The items that can come before each terminal, as a row of bits
+    // indexed by item for each terminal below terminals(), then a row for
+    // END_OF_INPUT and one for any other terminal. This is the same layout
+    // as GrammarTables::admissible.
+    const uint64_t*
+    admissible() const
+    {
+      return m_admissible;
     }
 
     private:
 
+    static constexpr uint32_t no_items = ~uint32_t(0);
+
+    // Adds the items of every rule, and takes their lookahead from
+    // `source`.
+    template <typename Source>
     void
-    fill_to(const grammar::Rule* rule, ItemStore& items,
-      size_t position);
+    build(const std::vector<grammar::RuleList>& rules, size_t terminals,
+      Source source);
 
-    ItemStore&
-    insert_rule(const grammar::Rule*);
+    // Every item, by its index.
+    std::vector<Item> m_items;
 
-    const ItemStore*
-    find_rule(const grammar::Rule* rule);
+    // The index of the first item of each rule, by the rule's index.
+    std::vector<uint32_t> m_rule_items;
 
-    std::vector<ItemStore> m_rule_array;
+    size_t m_terminals = 0;
+    size_t m_row_words = 0;
 
-    const grammar::FirstSets& m_firsts;
-    const grammar::FollowSets& m_follows;
-    const std::vector<bool>& m_nullable;
-    size_t m_item_index = 0;
+    // Either m_built, or the bitmap of the tables that it was loaded from.
+    const uint64_t* m_admissible = nullptr;
+    std::vector<uint64_t> m_built;
   };
 }
 
@@ -0,0 +1,109 @@
+#ifndef EARLEY_FAST_MEMBERSHIP_HPP_INCLUDED
+#define EARLEY_FAST_MEMBERSHIP_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+namespace earley::fast
+{
+  // The (item, distance) pairs in the set that is being built.
+  //
+  // It is an open addressed table where each slot is stamped with the
+  // generation it was written in, so that starting the next set is just
+  // incrementing the generation. The table only grows when one set has more
+  // start items than it can hold, so its size is bounded by the largest set
+  // rather than by the distances.
+  class Membership
+  {
+    public:
+
+    // The capacity is 2^bits.
+    Membership(int bits = 8, std::pmr::memory_resource* resource =
+      std::pmr::get_default_resource())
+    : m_slots(size_t(1) << bits, resource)
+    , m_bits(bits)
+    {
+    }
+
+    // Forget everything for the next set.
+    void
+    next()
+    {
+      ++m_generation;
+      m_size = 0;
+    }
+
+    // Returns true if the pair wasn't in the set yet.
+    bool
+    insert(size_t item, int distance)
+    {
+      if ((m_size + 1) * 2 > m_slots.size())
+      {
+        grow();
+      }
+
+      auto& slot = find(item, distance);
+      if (slot.generation == m_generation)
+      {
+        return false;
+      }
+
+      slot = Slot{m_generation, static_cast<uint32_t>(item), distance};
+      ++m_size;
+      return true;
+    }
+
+    private:
+    struct Slot
+    {
+      size_t generation = 0;
+      uint32_t item = 0;
+      int distance = 0;
+    };
+
+    Slot&
+    find(size_t item, int distance)
+    {
+      // Fibonacci hashing, the high bits of the product are the best mixed.
+      uint64_t key = (uint64_t(item) << 32) | uint32_t(distance);
+      size_t index = (key * 0x9e3779b97f4a7c15) >> (64 - m_bits);
+      auto mask = m_slots.size() - 1;
+
+      while (m_slots[index].generation == m_generation &&
+        (m_slots[index].item != item || m_slots[index].distance != distance))
+      {
+        index = (index + 1) & mask;
+      }
+
+      return m_slots[index];
+    }
+
+    void
+    grow()
+    {
+      std::pmr::vector<Slot> old(m_slots.size() * 2,
+        m_slots.get_allocator());
+      old.swap(m_slots);
+      ++m_bits;
+
+      for (auto& slot: old)
+      {
+        if (slot.generation == m_generation)
+        {
+          find(slot.item, slot.distance) = slot;
+        }
+      }
+    }
+
+    std::pmr::vector<Slot> m_slots;
+    int m_bits;
+    size_t m_size = 0;
+
+    // Starts at one so that the empty slots aren't in the first set.
+    size_t m_generation = 1;
+  };
+}
+
+#endif
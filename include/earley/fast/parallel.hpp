@@ -0,0 +1,134 @@
+#ifndef EARLEY_FAST_PARALLEL_HPP_INCLUDED
+#define EARLEY_FAST_PARALLEL_HPP_INCLUDED
+
+#include <exception>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "earley/fast.hpp"
+
+namespace earley::fast
+{
+  // The start symbol doesn't derive a list, so the sentences of the grammar
+  // can't be cut into sentences.
+  class NotAList : public std::exception
+  {
+  };
+
+  // The terminals that an input can be cut after, when they aren't inside
+  // any pair of brackets. For C these are ';' and '}', with the brackets
+  // '{' '}', '(' ')' and '[' ']'.
+  struct CutTerminals
+  {
+    std::vector<size_t> ends;
+    std::vector<std::pair<size_t, size_t>> brackets;
+  };
+
+  // The positions that `tokens` could be cut at, which are the positions
+  // after each end terminal at the top level. A run of end terminals is
+  // only cut after the last one.
+  std::vector<size_t>
+  cut_points(const TerminalList& tokens, const CutTerminals& terminals);
+
+  // The element of the list that the start symbol derives. The start
+  // symbol, after any rules that are a single nonterminal, has to have only
+  // rules of the form `S: X`, `S: S X`, `S: X S` or an empty rule, with at
+  // least one of the rules that repeat X, which make it a list of X. Throws
+  // NotAList otherwise.
+  grammar::Symbol
+  list_element(const CompiledGrammar& grammar);
+
+  // Recognises an input on several threads, for a grammar whose start
+  // symbol is a list, such as the declarations of a C file.
+  //
+  // The input is cut into chunks at some of its cut points, and each chunk
+  // is parsed on its own as though it were the whole input. Since the
+  // start symbol is a list, the input is a sentence if every chunk is. A
+  // cut point is only a guess, so when a chunk isn't a sentence it is
+  // joined to its neighbour and parsed again:
+  // - a chunk that fails at its end was cut too early, and is joined to
+  //   the next one;
+  // - a chunk that fails before its end was started at the wrong place,
+  //   and is joined to the one before. If that fails at the same place, it
+  //   is joined to everything before it.
+  //
+  // Parsing the first chunk is the same as parsing the start of the input
+  // until its last token, so a failure before that is where the whole
+  // input fails.
+  class ParallelParser
+  {
+    public:
+
+    struct Stats
+    {
+      size_t chunks = 0;
+      size_t rounds = 0;
+
+      // The tokens that were parsed in a chunk that was joined to another.
+      size_t reparsed = 0;
+    };
+
+    // Borrows the compiled grammar, which must outlive the parser. Throws
+    // NotAList if the start symbol isn't a list.
+    ParallelParser(const CompiledGrammar& grammar, size_t threads);
+
+    ParallelParser(const ParallelParser&) = delete;
+
+    // Returns where `tokens` failed, or nothing if it is in the language.
+    // The set of an error belongs to this parser, and is kept until the
+    // next call.
+    std::optional<ParseError>
+    recognise(const TerminalList& tokens, const std::vector<size_t>& cuts);
+
+    const Stats&
+    stats() const
+    {
+      return m_stats;
+    }
+
+    private:
+
+    struct Chunk
+    {
+      Chunk(size_t _begin, size_t _end)
+      : begin(_begin)
+      , end(_end)
+      {
+      }
+
+      size_t begin;
+      size_t end;
+
+      // The parser points to the tokens, so they can't move.
+      std::unique_ptr<TerminalList> tokens;
+      std::unique_ptr<Parser> parser;
+      std::optional<ParseError> error;
+
+      // Where it failed before its end the last time it was joined to the
+      // chunk before it.
+      std::optional<size_t> failed_at;
+    };
+
+    // Parse the chunks that haven't been parsed yet.
+    void
+    parse_chunks(const TerminalList& tokens);
+
+    // Join the chunks that failed to their neighbours.
+    void
+    join_chunks();
+
+    // The chunk from the start of `first` to the end of `second`, which
+    // hasn't been parsed.
+    Chunk
+    join(Chunk& first, Chunk& second);
+
+    const CompiledGrammar& m_grammar;
+    size_t m_threads;
+    std::vector<Chunk> m_chunks;
+    Stats m_stats;
+  };
+}
+
+#endif
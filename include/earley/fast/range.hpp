@@ -0,0 +1,47 @@
+#ifndef EARLEY_FAST_RANGE_HPP_INCLUDED
+#define EARLEY_FAST_RANGE_HPP_INCLUDED
+
+namespace earley::fast
+{
+  template <typename T>
+  class Range
+  {
+    public:
+    Range(T b, T e)
+    : m_begin(b)
+    , m_end(e)
+    {
+    }
+
+    T
+    begin() const
+    {
+      return m_begin;
+    }
+
+    T
+    end() const
+    {
+      return m_end;
+    }
+
+    auto
+    operator[](int i) const
+    {
+      return *(m_begin + i);
+    }
+
+    private:
+    T m_begin;
+    T m_end;
+  };
+
+  template <typename T>
+  Range<T>
+  make_range(T begin, T end)
+  {
+    return Range(begin, end);
+  }
+}
+
+#endif
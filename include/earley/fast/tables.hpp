@@ -0,0 +1,154 @@
+#ifndef EARLEY_FAST_TABLES_HPP_INCLUDED
+#define EARLEY_FAST_TABLES_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <lexertl/memory_file.hpp>
+
+#include "earley/fast/grammar.hpp"
+
+namespace earley::fast
+{
+  // A compiled grammar as flat arrays, so that the generator can write it
+  // out as source and a program can load it without working anything out.
+  //
+  // Nonterminals are numbered from zero. The rules are numbered in order of
+  // their nonterminal, and the items in order of their rule and then their
+  // dot, which is the order that Items numbers them in. An array of
+  // offsets has one more entry than the things it indexes, so that the
+  // entries for `i` are from offsets[i] to offsets[i+1].
+  struct GrammarTables
+  {
+    size_t nonterminals;
+    int start;
+
+    // The name of each nonterminal.
+    const char* const* names;
+    const bool* nullable;
+
+    // The rules of each nonterminal.
+    const uint32_t* rule_offsets;
+
+    // The symbols of each rule.
+    const uint32_t* symbol_offsets;
+    const grammar::Symbol* symbols;
+
+    // The action of each rule, and the symbols passed to it. An empty name
+    // is no action.
+    const char* const* actions;
+    const uint32_t* action_offsets;
+    const uint32_t* action_args;
+
+    // The bitsets from CompiledGrammar::admissible, a row of `row_words`
+    // for each terminal below `terminals`, then END_OF_INPUT, then every
+    // other terminal.
+    size_t items;
+    size_t terminals;
+    size_t row_words;
+    const uint64_t* admissible;
+
+    // Whether everything after the dot of each item can derive empty.
+    const bool* empty_rhs;
+
+    // The items that predicting each nonterminal adds, by their index.
+    const uint32_t* prediction_offsets;
+    const uint32_t* predictions;
+  };
+
+  class CompiledGrammar;
+
+  // The tables of a compiled grammar, together with the arrays that they
+  // point into.
+  class BuiltTables
+  {
+    public:
+
+    BuiltTables(const CompiledGrammar& grammar);
+
+    // The tables point into this object.
+    BuiltTables(const BuiltTables&) = delete;
+
+    const GrammarTables&
+    tables() const
+    {
+      return m_tables;
+    }
+
+    private:
+    std::vector<std::string> m_name_strings;
+    std::vector<const char*> m_names;
+    std::unique_ptr<bool[]> m_nullable;
+    std::vector<uint32_t> m_rule_offsets;
+    std::vector<uint32_t> m_symbol_offsets;
+    std::vector<grammar::Symbol> m_symbols;
+    std::vector<std::string> m_action_strings;
+    std::vector<const char*> m_actions;
+    std::vector<uint32_t> m_action_offsets;
+    std::vector<uint32_t> m_action_args;
+    std::vector<uint64_t> m_admissible;
+    std::unique_ptr<bool[]> m_empty_rhs;
+    std::vector<uint32_t> m_prediction_offsets;
+    std::vector<uint32_t> m_predictions;
+
+    GrammarTables m_tables;
+  };
+
+  // Writes `tables` in the binary format that MappedTables loads.
+  //
+  // The file is a header with the sizes of everything, then each array of
+  // GrammarTables in turn, starting on an eight byte boundary. Instead of
+  // pointers, the names and actions are offsets into a block of nul
+  // terminated strings at the end. Numbers are in the byte order of the
+  // machine that wrote them, and a file from a machine with the other
+  // order is rejected.
+  void
+  write_tables(std::ostream& os, const GrammarTables& tables);
+
+  // The data given to MappedTables isn't tables written by write_tables
+  // with this version of the format.
+  class BadTables : public std::exception
+  {
+  };
+
+  // Tables in the binary format, used where they are. A file is mapped
+  // rather than read, so processes that load the same file share its
+  // pages. Only the pointers to the strings are made when it is loaded.
+  class MappedTables
+  {
+    public:
+
+    // Maps the file at `path`.
+    MappedTables(const char* path);
+
+    // Tables that are already in memory, aligned to eight bytes, which
+    // must outlive this.
+    MappedTables(const char* data, size_t size);
+
+    MappedTables(const MappedTables&) = delete;
+
+    const GrammarTables&
+    tables() const
+    {
+      return m_tables;
+    }
+
+    private:
+
+    void
+    load(const char* data, size_t size);
+
+    lexertl::memory_file m_file;
+    std::vector<const char*> m_names;
+    std::vector<const char*> m_actions;
+
+    GrammarTables m_tables;
+  };
+}
+
+#endif
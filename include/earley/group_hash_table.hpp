@@ -0,0 +1,657 @@
+#ifndef EARLEY_GROUP_HASH_TABLE_HPP_INCLUDED
+#define EARLEY_GROUP_HASH_TABLE_HPP_INCLUDED
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <memory_resource>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define EARLEY_GROUP_SSE2 1
+#endif
+
+#include "earley_hash_set.hpp"
+
+namespace earley
+{
+  namespace detail
+  {
+    // The control byte of a slot that has never been used. A full slot has
+    // seven bits of its hash, so its byte is never negative.
+    constexpr int8_t control_empty = -128;
+
+    // The control byte of a slot that was erased, which a probe has to go
+    // past because it might have been full when a later key was added.
+    constexpr int8_t control_deleted = -2;
+
+    // The control bytes of a group of slots, which are compared all at once.
+    // Each match is a mask with bit `i` set for slot `i` of the group.
+    class ControlGroup
+    {
+      public:
+      static constexpr size_t width = 16;
+
+#ifdef EARLEY_GROUP_SSE2
+      ControlGroup(const int8_t* control)
+      : m_bytes(_mm_loadu_si128(reinterpret_cast<const __m128i*>(control)))
+      {
+      }
+
+      uint32_t
+      match(int8_t byte) const
+      {
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(byte),
+          m_bytes));
+      }
+
+      // The full slots are the ones without the sign bit.
+      uint32_t
+      match_full() const
+      {
+        return ~_mm_movemask_epi8(m_bytes) & 0xffff;
+      }
+
+      // The empty and deleted slots.
+      uint32_t
+      match_free() const
+      {
+        return _mm_movemask_epi8(m_bytes);
+      }
+
+      private:
+      __m128i m_bytes;
+#else
+      ControlGroup(const int8_t* control)
+      {
+        std::memcpy(m_bytes, control, width);
+      }
+
+      uint32_t
+      match(int8_t byte) const
+      {
+        uint32_t mask = 0;
+        for (size_t i = 0; i != width; ++i)
+        {
+          mask |= uint32_t(m_bytes[i] == byte) << i;
+        }
+        return mask;
+      }
+
+      uint32_t
+      match_full() const
+      {
+        uint32_t mask = 0;
+        for (size_t i = 0; i != width; ++i)
+        {
+          mask |= uint32_t(m_bytes[i] >= 0) << i;
+        }
+        return mask;
+      }
+
+      uint32_t
+      match_free() const
+      {
+        uint32_t mask = 0;
+        for (size_t i = 0; i != width; ++i)
+        {
+          mask |= uint32_t(m_bytes[i] < 0) << i;
+        }
+        return mask;
+      }
+
+      private:
+      int8_t m_bytes[width];
+#endif
+
+      public:
+      uint32_t
+      match_empty() const
+      {
+        return match(control_empty);
+      }
+    };
+
+    inline
+    int
+    lowest_bit(uint32_t mask)
+    {
+      return __builtin_ctz(mask);
+    }
+  }
+
+  // The same interface as the double hashed table, but the slots are in
+  // groups of sixteen with a control byte each in a separate array. The
+  // hash picks a group, and seven bits of it are compared with every
+  // control byte of the group at once, so the keys are only compared for
+  // the slots that probably match. A key is missing as soon as a group
+  // with an empty slot is probed. The groups are probed in triangular
+  // order, which visits all of them because there is a power of two.
+  //
+  // An erased slot is only marked as deleted if its group has no empty
+  // slots, since otherwise no probe has ever gone past the group.
+  //
+  // The hash is mixed first, since the hashes of pointers and small
+  // numbers don't have enough bits that vary for the control bytes.
+  template <typename T, typename Mapping, typename Hash, typename Equality>
+  class HashTable<T, Mapping, Hash, Equality, GroupProbing>
+  {
+    private:
+    using IsSet = std::is_same<Mapping, void>;
+
+    using Storage = std::conditional_t<IsSet::value,
+      T, std::pair<const T, Mapping>>;
+    using StorageSequence = std::conditional_t<IsSet::value,
+      int, std::make_index_sequence<2>>;
+    using construct_storage_t = detail::HashStorageConstruct<Storage>;
+    construct_storage_t construct_storage;
+
+    using Key = std::conditional_t<IsSet::value,
+      detail::identity,
+      detail::first
+    >;
+    Key M_key;
+
+    using Group = detail::ControlGroup;
+
+    public:
+
+    class const_iterator
+    {
+      public:
+
+      typedef const Storage& reference;
+      typedef Storage value_type;
+      typedef size_t difference_type;
+      typedef Storage* pointer;
+      typedef std::forward_iterator_tag iterator_category;
+
+      const_iterator(const HashTable* table, size_t pos)
+      : m_table(table)
+      , m_pos(pos)
+      {
+      }
+
+      const_iterator&
+      operator++()
+      {
+        ++m_pos;
+        while (m_pos != m_table->m_capacity &&
+          m_table->m_control[m_pos] < 0)
+        {
+          ++m_pos;
+        }
+
+        return *this;
+      }
+
+      const auto&
+      operator*() const
+      {
+        return *(m_table->m_memory + m_pos);
+      }
+
+      auto
+      operator->() const
+      {
+        return m_table->m_memory + m_pos;
+      }
+
+      bool
+      operator==(const const_iterator& rhs) const
+      {
+        return m_table == rhs.m_table && m_pos == rhs.m_pos;
+      }
+
+      bool
+      operator!=(const const_iterator& rhs) const
+      {
+        return !operator==(rhs);
+      }
+
+      private:
+      friend class HashTable;
+
+      const HashTable* m_table;
+      size_t m_pos;
+    };
+
+    typedef const_iterator iterator;
+
+    HashTable()
+    : HashTable(0)
+    {
+    }
+
+    // Room for at least `size` slots, which are allocated from `resource`.
+    HashTable(size_t size, std::pmr::memory_resource* resource =
+      std::pmr::get_default_resource())
+    : m_resource(resource)
+    {
+      size_t groups = 1;
+      while (groups * Group::width < size)
+      {
+        groups *= 2;
+      }
+
+      if (size > 0)
+      {
+        allocate(groups);
+      }
+    }
+
+    HashTable(const HashTable&) = delete;
+
+    HashTable(HashTable&& rhs)
+    {
+      swap(rhs);
+    }
+
+    ~HashTable()
+    {
+      destroy();
+      deallocate();
+    }
+
+    const_iterator
+    begin() const
+    {
+      return const_iterator(this, m_first);
+    }
+
+    const_iterator
+    end() const
+    {
+      return const_iterator(this, m_capacity);
+    }
+
+    template <typename Iterator>
+    void
+    insert(Iterator begin, Iterator end)
+    {
+      while (begin != end)
+      {
+        insert(*begin);
+        ++begin;
+      }
+    }
+
+    std::pair<const_iterator, bool>
+    insert(const Storage& t)
+    {
+      return insert_unpack(t, StorageSequence());
+    }
+
+    std::pair<const_iterator, bool>
+    insert(Storage&& t)
+    {
+      return insert_unpack(std::move(t), StorageSequence());
+    }
+
+    template <typename... Args>
+    std::pair<const_iterator, bool>
+    emplace(Args&&... args)
+    {
+      return insert_impl(std::forward<Args>(args)...);
+    }
+
+    // Returns the number of elements removed.
+    size_t
+    erase(const T& t)
+    {
+      auto iter = find(t);
+      if (iter == end())
+      {
+        return 0;
+      }
+
+      erase(iter);
+      return 1;
+    }
+
+    void
+    erase(const_iterator iter)
+    {
+      auto pos = iter.m_pos;
+      m_memory[pos].~Storage();
+
+      auto group = pos / Group::width * Group::width;
+      if (Group(m_control + group).match_empty() != 0)
+      {
+        m_control[pos] = detail::control_empty;
+      }
+      else
+      {
+        m_control[pos] = detail::control_deleted;
+        ++m_tombstones;
+      }
+      --m_elements;
+
+      if (pos == m_first)
+      {
+        m_first = (++iter).m_pos;
+      }
+    }
+
+    size_t
+    size() const
+    {
+      return m_elements;
+    }
+
+    size_t
+    capacity() const
+    {
+      return m_capacity;
+    }
+
+    double
+    load_factor() const
+    {
+      return m_capacity == 0 ? 0 : double(m_elements) / m_capacity;
+    }
+
+    // Make room for `count` elements without resizing.
+    void
+    reserve(size_t count)
+    {
+      size_t groups = m_groups == 0 ? 1 : m_groups;
+      while (count * 8 > groups * Group::width * 7)
+      {
+        groups *= 2;
+      }
+
+      if (groups != m_groups)
+      {
+        rehash(groups);
+      }
+    }
+
+    // Remove everything but keep the memory.
+    void
+    clear()
+    {
+      destroy();
+      if (m_capacity > 0)
+      {
+        std::memset(m_control, detail::control_empty, m_capacity);
+      }
+
+      m_elements = 0;
+      m_tombstones = 0;
+      m_first = m_capacity;
+    }
+
+    const HashStats&
+    stats() const
+    {
+      return m_stats;
+    }
+
+    const_iterator
+    find(const T& t) const
+    {
+      if (m_capacity > 0)
+      {
+        auto hash = mix(Hash()(t));
+        auto byte = control(hash);
+        auto group = first_group(hash);
+
+        for (size_t step = 1;; ++step)
+        {
+          Group bytes(m_control + group * Group::width);
+          for (auto mask = bytes.match(byte); mask != 0; mask &= mask - 1)
+          {
+            auto pos = group * Group::width + detail::lowest_bit(mask);
+            if (Equality()(t, M_key(m_memory[pos])))
+            {
+              m_stats.lookup(step - 1);
+              return const_iterator(this, pos);
+            }
+          }
+
+          if (bytes.match_empty() != 0)
+          {
+            m_stats.lookup(step - 1);
+            break;
+          }
+
+          group = (group + step) & (m_groups - 1);
+          ++hashtable_collisions;
+        }
+      }
+
+      return end();
+    }
+
+    int
+    count(const T& t) const
+    {
+      return find(t) != end() ? 1 : 0;
+    }
+
+    private:
+
+    // The hashes of pointers only vary in their middle bits, so mix all of
+    // them into the bits that are used.
+    static size_t
+    mix(size_t hash)
+    {
+      auto mixed = static_cast<unsigned __int128>(hash) * 0x9e3779b97f4a7c15;
+      return static_cast<uint64_t>(mixed) ^ static_cast<uint64_t>(mixed >> 64);
+    }
+
+    static int8_t
+    control(size_t hash)
+    {
+      return hash & 0x7f;
+    }
+
+    size_t
+    first_group(size_t hash) const
+    {
+      return (hash >> 7) & (m_groups - 1);
+    }
+
+    template <typename S>
+    auto
+    insert_unpack(S&& storage, int)
+    {
+      return insert_impl(std::forward<S>(storage));
+    }
+
+    template <typename S, size_t... I>
+    auto
+    insert_unpack(S&& storage, std::index_sequence<I...>)
+    {
+      return insert_impl(std::get<I>(std::forward<S>(storage))...);
+    }
+
+    template <typename Value, typename... Args>
+    std::pair<const_iterator, bool>
+    insert_impl(Value&& t, Args&&... args)
+    {
+      // Tombstones count towards the load, since they lengthen the probes
+      // just the same.
+      if ((m_elements + m_tombstones + 1) * 8 > m_capacity * 7)
+      {
+        // Only grow when it is the elements that fill it.
+        if (m_groups == 0 || (m_elements + 1) * 16 > m_capacity * 7)
+        {
+          rehash(m_groups == 0 ? 1 : m_groups * 2);
+        }
+        else
+        {
+          rehash(m_groups);
+        }
+      }
+
+      auto hash = mix(Hash()(t));
+      auto byte = control(hash);
+      auto group = first_group(hash);
+
+      // The first tombstone on the way, which is reused if the key isn't
+      // there.
+      size_t free = m_capacity;
+
+      for (size_t step = 1;; ++step)
+      {
+        Group bytes(m_control + group * Group::width);
+        for (auto mask = bytes.match(byte); mask != 0; mask &= mask - 1)
+        {
+          auto pos = group * Group::width + detail::lowest_bit(mask);
+          if (Equality()(t, M_key(m_memory[pos])))
+          {
+            m_stats.lookup(step - 1);
+            return std::make_pair(const_iterator(this, pos), false);
+          }
+        }
+
+        if (free == m_capacity)
+        {
+          if (auto slots = bytes.match_free(); slots != 0)
+          {
+            free = group * Group::width + detail::lowest_bit(slots);
+          }
+        }
+
+        if (bytes.match_empty() != 0)
+        {
+          m_stats.lookup(step - 1);
+          auto pos = free;
+          new(m_memory + pos) Storage(
+            construct_storage(std::forward<Value>(t),
+              std::forward<Args>(args)...)
+          );
+          place(pos, byte);
+          return std::make_pair(const_iterator(this, pos), true);
+        }
+
+        group = (group + step) & (m_groups - 1);
+        ++hashtable_collisions;
+      }
+    }
+
+    // The key isn't in the table, so take the first empty slot.
+    size_t
+    find_empty(size_t hash) const
+    {
+      auto group = first_group(hash);
+      for (size_t step = 1;; ++step)
+      {
+        auto empty = Group(m_control + group * Group::width).match_empty();
+        if (empty != 0)
+        {
+          return group * Group::width + detail::lowest_bit(empty);
+        }
+
+        group = (group + step) & (m_groups - 1);
+      }
+    }
+
+    void
+    place(size_t pos, int8_t byte)
+    {
+      if (m_control[pos] == detail::control_deleted)
+      {
+        --m_tombstones;
+      }
+
+      m_control[pos] = byte;
+      ++m_elements;
+
+      if (pos < m_first)
+      {
+        m_first = pos;
+      }
+    }
+
+    void
+    allocate(size_t groups)
+    {
+      m_groups = groups;
+      m_capacity = groups * Group::width;
+      m_first = m_capacity;
+      m_control = static_cast<int8_t*>(m_resource->allocate(m_capacity, 1));
+      std::memset(m_control, detail::control_empty, m_capacity);
+      m_memory = static_cast<Storage*>(
+        m_resource->allocate(m_capacity * sizeof(Storage), alignof(Storage)));
+    }
+
+    void
+    deallocate()
+    {
+      if (m_capacity > 0)
+      {
+        m_resource->deallocate(m_control, m_capacity, 1);
+        m_resource->deallocate(m_memory, m_capacity * sizeof(Storage),
+          alignof(Storage));
+      }
+    }
+
+    void
+    destroy()
+    {
+      for (size_t i = 0; i != m_capacity; ++i)
+      {
+        if (m_control[i] >= 0)
+        {
+          m_memory[i].~Storage();
+        }
+      }
+    }
+
+    // Move everything to a table with `groups` groups, which drops the
+    // tombstones.
+    void
+    rehash(size_t groups)
+    {
+      HashTable moved(0, m_resource);
+      moved.allocate(groups);
+
+      for (size_t i = 0; i != m_capacity; ++i)
+      {
+        if (m_control[i] >= 0)
+        {
+          auto hash = mix(Hash()(M_key(m_memory[i])));
+          auto pos = moved.find_empty(hash);
+          new(moved.m_memory + pos) Storage(std::move(m_memory[i]));
+          moved.place(pos, control(hash));
+        }
+      }
+
+      moved.m_stats = m_stats;
+      moved.m_stats.resized();
+      swap(moved);
+    }
+
+    void
+    swap(HashTable& other)
+    {
+      std::swap(other.m_resource, m_resource);
+      std::swap(other.m_control, m_control);
+      std::swap(other.m_memory, m_memory);
+      std::swap(other.m_groups, m_groups);
+      std::swap(other.m_capacity, m_capacity);
+      std::swap(other.m_elements, m_elements);
+      std::swap(other.m_tombstones, m_tombstones);
+      std::swap(other.m_first, m_first);
+      std::swap(other.m_stats, m_stats);
+    }
+
+    std::pmr::memory_resource* m_resource =
+      std::pmr::get_default_resource();
+    int8_t* m_control = nullptr;
+    Storage* m_memory = nullptr;
+    size_t m_groups = 0;
+    size_t m_capacity = 0;
+    size_t m_elements = 0;
+    size_t m_tombstones = 0;
+    size_t m_first = 0;
+    mutable HashStats m_stats;
+  };
+}
+
+#endif
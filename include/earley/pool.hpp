@@ -0,0 +1,110 @@
+#ifndef EARLEY_POOL_HPP
+#define EARLEY_POOL_HPP
+
+#include <memory>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+namespace earley
+{
+  // Objects that never move once they are made. They are allocated in
+  // blocks, and each block is twice the size of the one before, so the
+  // memory used grows with the number of objects rather than being reserved
+  // up front.
+  template <typename T>
+  class BlockPool
+  {
+    public:
+
+    // The blocks are allocated from `resource`, which must outlive the
+    // pool.
+    BlockPool(size_t first_block = 64,
+      std::pmr::memory_resource* resource =
+        std::pmr::get_default_resource());
+    ~BlockPool();
+
+    // Everything in the pool is pointed to from elsewhere.
+    BlockPool(const BlockPool&) = delete;
+    BlockPool& operator=(const BlockPool&) = delete;
+
+    template <typename... Args>
+    T&
+    emplace_back(Args&&... args);
+
+    T&
+    back();
+
+    size_t
+    size() const
+    {
+      return m_size;
+    }
+
+    private:
+    struct Block
+    {
+      T* objects;
+      size_t capacity;
+    };
+
+    std::pmr::polymorphic_allocator<T> m_allocator;
+    std::pmr::vector<Block> m_blocks;
+    size_t m_next_block;
+
+    // The number of objects in the last block.
+    size_t m_used = 0;
+    size_t m_size = 0;
+  };
+
+  template <typename T>
+  BlockPool<T>::BlockPool(size_t first_block,
+    std::pmr::memory_resource* resource)
+  : m_allocator(resource)
+  , m_blocks(resource)
+  , m_next_block(first_block)
+  {
+  }
+
+  template <typename T>
+  BlockPool<T>::~BlockPool()
+  {
+    for (size_t i = 0; i != m_blocks.size(); ++i)
+    {
+      auto& block = m_blocks[i];
+      auto used = i + 1 == m_blocks.size() ? m_used : block.capacity;
+      std::destroy_n(block.objects, used);
+      m_allocator.deallocate(block.objects, block.capacity);
+    }
+  }
+
+  template <typename T>
+  template <typename... Args>
+  T&
+  BlockPool<T>::emplace_back(Args&&... args)
+  {
+    if (m_blocks.empty() || m_used == m_blocks.back().capacity)
+    {
+      m_blocks.push_back({m_allocator.allocate(m_next_block), m_next_block});
+      m_next_block *= 2;
+      m_used = 0;
+    }
+
+    auto object = m_blocks.back().objects + m_used;
+    new (object) T(std::forward<Args>(args)...);
+
+    ++m_used;
+    ++m_size;
+
+    return *object;
+  }
+
+  template <typename T>
+  T&
+  BlockPool<T>::back()
+  {
+    return m_blocks.back().objects[m_used - 1];
+  }
+}
+
+#endif
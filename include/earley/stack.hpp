@@ -10,9 +10,21 @@ namespace earley
   {
     public:
 
-    Stack();
+    // The stack's memory is allocated from `resource`, which must outlive
+    // it.
+    Stack(std::pmr::memory_resource* resource =
+      std::pmr::get_default_resource());
     ~Stack();
 
+    // Reserves a range of address space, which is only backed by memory
+    // as the stack grows into it. The sequences never move, and when the
+    // range is full emplace_back throws std::bad_alloc. Only the stack
+    // itself is allocated from `resource`.
+    Stack(const StackReserve& reserve, std::pmr::memory_resource* resource =
+      std::pmr::get_default_resource());
+
+    Stack(const Stack&) = delete;
+
     // Start a new contiguous sequence.
     T*
     start();
@@ -37,7 +49,18 @@ namespace earley
     size_t
     top_size() const;
 
+    // Give the memory after the end of the stack back to the system. Only
+    // a reserved stack has any to give back.
+    void
+    trim();
+
+    // Destroy everything in the stack, and give back what memory can be
+    // given back, such as between parses.
+    void
+    release();
+
     private:
+    std::pmr::memory_resource* m_resource;
     detail::stack_segment<T>* m_top_segment;
     bool m_owned = false;
   };
@@ -47,15 +70,24 @@ namespace earley
   class StackNotOwned {};
 
   template <typename T>
-  Stack<T>::Stack()
+  Stack<T>::Stack(std::pmr::memory_resource* resource)
+  : m_resource(resource)
   {
-    m_top_segment = new detail::stack_segment<T>;
+    m_top_segment = detail::stack_segment<T>::create(m_resource);
+  }
+
+  template <typename T>
+  Stack<T>::Stack(const StackReserve& reserve,
+    std::pmr::memory_resource* resource)
+  : m_resource(resource)
+  {
+    m_top_segment = detail::stack_segment<T>::create(m_resource, reserve);
   }
 
   template <typename T>
   Stack<T>::~Stack()
   {
-    delete m_top_segment;
+    detail::stack_segment<T>::release(m_top_segment);
   }
 
   template <typename T>
@@ -78,10 +110,16 @@ namespace earley
   Stack<T>::emplace_back(Args&&... args)
   {
     auto& top = *m_top_segment;
-    if (top.size() == top.capacity())
+    if (top.size() == top.capacity() && top.reserved())
+    {
+      // A reserved segment grows where it is.
+      top.commit(1);
+    }
+    else if (top.size() == top.capacity())
     {
       // we need to reallocate and return the new pointer
-      auto next = new detail::stack_segment<T>(m_top_segment, m_top_segment->size()*2);
+      auto next = detail::stack_segment<T>::create(m_resource, m_top_segment,
+        m_top_segment->size()*2);
       next->append(top.top(), top.current());
       next->emplace_back(std::forward<Args>(args)...);
 
@@ -91,11 +129,9 @@ namespace earley
 
       return next->top();
     }
-    else
-    {
-      top.emplace_back(std::forward<Args>(args)...);
-      return top.top();
-    }
+
+    top.emplace_back(std::forward<Args>(args)...);
+    return top.top();
   }
 
   template <typename T>
@@ -124,6 +160,26 @@ namespace earley
   {
     return m_top_segment->top_size();
   }
+
+  template <typename T>
+  void
+  Stack<T>::trim()
+  {
+    m_top_segment->trim();
+  }
+
+  template <typename T>
+  void
+  Stack<T>::release()
+  {
+    if (m_owned)
+    {
+      throw StackOwned();
+    }
+
+    m_top_segment->clear();
+    m_top_segment->trim();
+  }
 }
 
 #endif
@@ -1,9 +1,13 @@
 #ifndef EARLEY_STACK_IMP_HPP
 #define EARLEY_STACK_IMP_HPP
 
+#include <algorithm>
 #include <cstring>
+#include <memory_resource>
 #include <type_traits>
 
+#include <earley/stack/reserve.hpp>
+
 namespace earley::detail
 {
   template <typename T, bool trivial_destroy>
@@ -47,30 +51,134 @@ namespace earley::detail
     item_copy m_copy;
 
     public:
-    stack_segment()
-    : stack_segment(nullptr)
+    // The segment and its memory are both allocated from `resource`.
+    static stack_segment*
+    create(std::pmr::memory_resource* resource,
+      const stack_segment* previous = nullptr, size_t size = 2000)
+    {
+      auto memory = resource->allocate(sizeof(stack_segment),
+        alignof(stack_segment));
+      return new (memory) stack_segment(resource, previous, size);
+    }
+
+    // A segment that never moves, in its own range of address space.
+    static stack_segment*
+    create(std::pmr::memory_resource* resource, const StackReserve& reserve)
     {
+      auto memory = resource->allocate(sizeof(stack_segment),
+        alignof(stack_segment));
+      return new (memory) stack_segment(resource, reserve);
     }
 
-    stack_segment(const stack_segment* _previous)
-    : stack_segment(_previous, 2000)
+    // Release a segment from create, and the ones before it.
+    static void
+    release(const stack_segment* segment)
     {
+      if (segment != nullptr)
+      {
+        auto resource = segment->m_resource;
+        segment->~stack_segment();
+        resource->deallocate(const_cast<stack_segment*>(segment),
+          sizeof(stack_segment), alignof(stack_segment));
+      }
     }
 
-    stack_segment(const stack_segment* _previous, size_t size)
-    : m_previous(_previous)
+    stack_segment(std::pmr::memory_resource* resource,
+      const stack_segment* _previous, size_t size)
+    : m_resource(resource)
+    , m_previous(_previous)
     , m_size(size)
     {
-      m_memory = static_cast<T*>(operator new(size * sizeof(T)));
+      m_memory = static_cast<T*>(
+        m_resource->allocate(size * sizeof(T), alignof(T)));
+      m_top = m_memory;
+      m_current = m_top;
+    }
+
+    stack_segment(std::pmr::memory_resource* resource,
+      const StackReserve& reserve)
+    : m_resource(resource)
+    , m_previous(nullptr)
+    , m_size(0)
+    , m_reserved(round_to_pages(std::max<size_t>(reserve.bytes, 1)))
+    {
+      m_memory = static_cast<T*>(reserve_pages(m_reserved,
+        reserve.huge_pages));
       m_top = m_memory;
       m_current = m_top;
     }
 
     ~stack_segment() {
-      delete m_previous;
+      release(m_previous);
 
       m_destroy(m_memory, m_top);
-      operator delete(m_memory);
+      if (reserved())
+      {
+        free_pages(m_memory, m_reserved);
+      }
+      else
+      {
+        m_resource->deallocate(m_memory, m_size * sizeof(T), alignof(T));
+      }
+    }
+
+    bool
+    reserved() const
+    {
+      return m_reserved != 0;
+    }
+
+    // Commit enough of a reserved segment for `count` more objects. At
+    // least as much as is already committed is added, so that there are
+    // few calls to the system. Throws std::bad_alloc when the reserved
+    // range is full.
+    void
+    commit(size_t count)
+    {
+      auto needed = (size() + count) * sizeof(T);
+      if (needed > m_reserved)
+      {
+        throw std::bad_alloc();
+      }
+
+      auto committed = std::min(m_reserved, round_to_pages(
+        std::max({needed, m_committed * 2, size_t(64 * 1024)})));
+      commit_pages(reinterpret_cast<char*>(m_memory) + m_committed,
+        committed - m_committed);
+      m_committed = committed;
+      m_size = m_committed / sizeof(T);
+    }
+
+    // Give back the committed pages after the end of a reserved segment.
+    void
+    trim()
+    {
+      if (!reserved())
+      {
+        return;
+      }
+
+      auto used = round_to_pages(size() * sizeof(T));
+      if (used < m_committed)
+      {
+        decommit_pages(reinterpret_cast<char*>(m_memory) + used,
+          m_committed - used);
+        m_committed = used;
+        m_size = m_committed / sizeof(T);
+      }
+    }
+
+    // Destroy everything, including the segments before this one, and keep
+    // this segment's memory.
+    void
+    clear()
+    {
+      release(m_previous);
+      m_previous = nullptr;
+
+      m_destroy(m_memory, m_current);
+      m_top = m_memory;
+      m_current = m_memory;
     }
 
     T*
@@ -134,11 +242,17 @@ namespace earley::detail
 
     private:
 
+    std::pmr::memory_resource* m_resource;
     const stack_segment* m_previous;
     T* m_memory;
     T* m_top;
     T* m_current;
     size_t m_size;
+
+    // The address space and the part of it that is committed, in bytes,
+    // for a reserved segment.
+    size_t m_reserved = 0;
+    size_t m_committed = 0;
   };
 }
 
@@ -0,0 +1,95 @@
+#ifndef EARLEY_STACK_RESERVE_HPP
+#define EARLEY_STACK_RESERVE_HPP
+
+#include <cstddef>
+#include <new>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace earley
+{
+  // Address space for a Stack that never moves what is in it. The range
+  // is reserved up front, and pages are only given memory as the stack
+  // reaches them.
+  struct StackReserve
+  {
+    // The most that the stack can ever hold, in bytes.
+    size_t bytes;
+
+    // Ask for transparent huge pages for the range, where they exist.
+    bool huge_pages = false;
+  };
+}
+
+namespace earley::detail
+{
+  inline
+  size_t
+  page_size()
+  {
+    static const size_t size = sysconf(_SC_PAGESIZE);
+    return size;
+  }
+
+  inline
+  size_t
+  round_to_pages(size_t bytes)
+  {
+    auto page = page_size();
+    return (bytes + page - 1) / page * page;
+  }
+
+  // Address space that can't be touched until it is committed.
+  inline
+  void*
+  reserve_pages(size_t bytes, bool huge_pages)
+  {
+    auto memory = mmap(nullptr, bytes, PROT_NONE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+      throw std::bad_alloc();
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (huge_pages)
+    {
+      madvise(memory, bytes, MADV_HUGEPAGE);
+    }
+#else
+    static_cast<void>(huge_pages);
+#endif
+
+    return memory;
+  }
+
+  inline
+  void
+  commit_pages(void* begin, size_t bytes)
+  {
+    if (mprotect(begin, bytes, PROT_READ | PROT_WRITE) != 0)
+    {
+      throw std::bad_alloc();
+    }
+  }
+
+  // Give the memory back, and make the pages untouchable again. Mapping
+  // over them does both at once.
+  inline
+  void
+  decommit_pages(void* begin, size_t bytes)
+  {
+    mmap(begin, bytes, PROT_NONE,
+      MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  }
+
+  inline
+  void
+  free_pages(void* begin, size_t bytes)
+  {
+    munmap(begin, bytes);
+  }
+}
+
+#endif
@@ -1,23 +1,108 @@
 #ifndef EARLEY_HASH_SET_HPP_INCLUDED
 #define EARLEY_HASH_SET_HPP_INCLUDED
 
+#include <atomic>
 #include <cstddef>
 #include <iterator>
+#include <memory_resource>
 #include <vector>
 
 namespace earley
 {
+  // How a HashTable finds the slot of a key.
+
+  // Double hashing over a prime number of slots, with a bit for each slot
+  // to say whether it is used.
+  struct DoubleHashing {};
+
+  // A byte for each slot with seven bits of the hash, so that a group of
+  // slots is compared at once. See earley/group_hash_table.hpp.
+  struct GroupProbing {};
+
   template <typename Key, typename Value,
     typename Hash = std::hash<Key>,
-    typename Equal = std::equal_to<Key>>
+    typename Equal = std::equal_to<Key>,
+    typename Probing = DoubleHashing>
   class HashTable;
 
   template <typename T,
     typename Hash = std::hash<T>,
-    typename Equal = std::equal_to<T>>
-  using HashSet = HashTable<T, void, Hash, Equal>;
+    typename Equal = std::equal_to<T>,
+    typename Probing = DoubleHashing>
+  using HashSet = HashTable<T, void, Hash, Equal, Probing>;
+
+  // Counted per thread, so that tables can be probed from many threads.
+  extern thread_local size_t hashtable_collisions;
+
+  // How well a table is probing. The counters are only kept when
+  // EARLEY_HASH_STATS is defined, and otherwise this is empty and counting
+  // does nothing. A const table can be looked up from many threads at
+  // once, so the counters are atomic. They are only counts, so the order
+  // doesn't matter.
+#ifdef EARLEY_HASH_STATS
+  struct HashStats
+  {
+    std::atomic<size_t> lookups = 0;
+
+    // The slots or groups after the first that were looked at.
+    std::atomic<size_t> probes = 0;
+    std::atomic<size_t> longest_probe = 0;
+    std::atomic<size_t> resizes = 0;
+
+    HashStats() = default;
+
+    HashStats(const HashStats& rhs)
+    {
+      *this = rhs;
+    }
+
+    HashStats&
+    operator=(const HashStats& rhs)
+    {
+      lookups.store(rhs.lookups.load(std::memory_order_relaxed),
+        std::memory_order_relaxed);
+      probes.store(rhs.probes.load(std::memory_order_relaxed),
+        std::memory_order_relaxed);
+      longest_probe.store(rhs.longest_probe.load(std::memory_order_relaxed),
+        std::memory_order_relaxed);
+      resizes.store(rhs.resizes.load(std::memory_order_relaxed),
+        std::memory_order_relaxed);
+      return *this;
+    }
 
-  extern size_t hashtable_collisions;
+    void
+    lookup(size_t length)
+    {
+      lookups.fetch_add(1, std::memory_order_relaxed);
+      probes.fetch_add(length, std::memory_order_relaxed);
+
+      auto longest = longest_probe.load(std::memory_order_relaxed);
+      while (length > longest && !longest_probe.compare_exchange_weak(
+        longest, length, std::memory_order_relaxed))
+      {
+      }
+    }
+
+    void
+    resized()
+    {
+      resizes.fetch_add(1, std::memory_order_relaxed);
+    }
+  };
+#else
+  struct HashStats
+  {
+    void
+    lookup(size_t)
+    {
+    }
+
+    void
+    resized()
+    {
+    }
+  };
+#endif
 
   template <typename T, typename M, typename H, typename E>
   class HashSetIterator
@@ -165,7 +250,8 @@ namespace earley
   template <typename T,
     typename Mapping = void,
     typename Hash,
-    typename Equality
+    typename Equality,
+    typename Probing
   >
   class HashTable
   {
@@ -195,16 +281,24 @@ namespace earley
     {
     }
 
-    HashTable(size_t size)
+    // The slots are allocated from `resource`, which must outlive the
+    // table.
+    HashTable(size_t size, std::pmr::memory_resource* resource =
+      std::pmr::get_default_resource())
     : m_elements(0)
     , m_size(size == 0 ? 0 : detail::next_prime(size))
     , m_first(m_size)
+    , m_occupied(resource)
+    , m_deleted(resource)
     , m_memory(nullptr)
+    , m_resource(resource)
     {
       if (m_size > 0)
       {
         m_occupied.insert(m_occupied.end(), m_size, false);
-        m_memory = static_cast<Storage*>(malloc(m_size * sizeof(Storage)));
+        m_deleted.insert(m_deleted.end(), m_size, false);
+        m_memory = static_cast<Storage*>(
+          m_resource->allocate(m_size * sizeof(Storage), alignof(Storage)));
       }
     }
 
@@ -212,15 +306,20 @@ namespace earley
 
     HashTable(HashTable&& rhs)
     : m_occupied(std::move(rhs.m_occupied))
+    , m_deleted(std::move(rhs.m_deleted))
+    , m_resource(rhs.m_resource)
+    , m_stats(rhs.m_stats)
     {
       m_memory = rhs.m_memory;
       m_first = rhs.m_first;
       m_size = rhs.m_size;
       m_elements = rhs.m_elements;
+      m_tombstones = rhs.m_tombstones;
 
       rhs.m_memory = nullptr;
       rhs.m_size = 0;
       rhs.m_elements = 0;
+      rhs.m_tombstones = 0;
       rhs.m_first = 0;
     }
 
@@ -234,7 +333,11 @@ namespace earley
         }
       }
 
-      free(m_memory);
+      if (m_memory != nullptr)
+      {
+        m_resource->deallocate(m_memory, m_size * sizeof(Storage),
+          alignof(Storage));
+      }
     }
 
     const_iterator
@@ -279,6 +382,38 @@ namespace earley
       return insert_internal(std::forward<Args>(args)...);
     }
 
+    // Returns the number of elements removed.
+    size_t
+    erase(const T& t)
+    {
+      auto iter = find(t);
+      if (iter == end())
+      {
+        return 0;
+      }
+
+      erase(iter);
+      return 1;
+    }
+
+    // The slot is left as a tombstone, so that the keys that were probed
+    // past it can still be found.
+    void
+    erase(const_iterator iter)
+    {
+      auto pos = iter.m_pos;
+      m_memory[pos].~Storage();
+      m_occupied[pos] = false;
+      m_deleted[pos] = true;
+      --m_elements;
+      ++m_tombstones;
+
+      if (pos == m_first)
+      {
+        m_first = (++iter).m_pos;
+      }
+    }
+
     size_t
     size() const
     {
@@ -291,8 +426,53 @@ namespace earley
       return m_size;
     }
 
+    double
+    load_factor() const
+    {
+      return m_size == 0 ? 0 : double(m_elements) / m_size;
+    }
+
+    // Make room for `count` elements without resizing.
+    void
+    reserve(size_t count)
+    {
+      // The table is resized when it is three quarters full.
+      auto needed = count + count / 3 + 1;
+      if (needed > m_size)
+      {
+        rehash(needed);
+      }
+    }
+
+    // Remove everything but keep the memory.
+    void
+    clear()
+    {
+      for (size_t i = 0; i != m_size; ++i)
+      {
+        if (m_occupied[i])
+        {
+          m_memory[i].~Storage();
+          m_occupied[i] = false;
+        }
+        m_deleted[i] = false;
+      }
+
+      m_elements = 0;
+      m_tombstones = 0;
+      m_first = m_size;
+    }
+
+    const HashStats&
+    stats() const
+    {
+      return m_stats;
+    }
+
     private:
 
+    // The slot with `t` in it, or the slot to put it in if there isn't one,
+    // which is the first tombstone on the way to an empty slot.
     size_t
     find_position(const T& t) const
     {
@@ -302,22 +482,41 @@ namespace earley
       //size_t secondary = 2;
       key %= m_size;
 
+      size_t tombstone = m_size;
+      size_t probes = 0;
       while (true)
       {
-        if (!m_occupied[key] || Equality()(t, M_key(m_memory[key])))
+        if (m_occupied[key])
         {
-          return key;
+          if (Equality()(t, M_key(m_memory[key])))
+          {
+            break;
+          }
         }
-        else
+        else if (!m_deleted[key])
         {
-          key += secondary;
-          if (key >= m_size)
+          if (tombstone != m_size)
           {
-            key -= m_size;
+            key = tombstone;
           }
+          break;
         }
+        else if (tombstone == m_size)
+        {
+          tombstone = key;
+        }
+
+        key += secondary;
+        if (key >= m_size)
+        {
+          key -= m_size;
+        }
+        ++probes;
         ++hashtable_collisions;
       }
+
+      m_stats.lookup(probes);
+      return key;
     }
 
     public:
@@ -350,9 +549,13 @@ namespace earley
     std::pair<const_iterator, bool>
     insert_internal(Value&& t)
     {
-      if (m_elements/3 >= m_size/4)
+      // Tombstones count towards the load, since they lengthen the probes
+      // just the same.
+      if ((m_elements + m_tombstones)/3 >= m_size/4)
       {
-        resize();
+        // Only grow when it is the elements that fill it. The next prime
+        // after m_size - 2 is m_size.
+        rehash(m_elements/3 >= m_size/8 ? m_size * 2 + 1 : m_size - 2);
       }
 
       return insert_unchecked(std::forward<Value>(t));
@@ -408,6 +611,12 @@ namespace earley
         inserted = true;
         ++m_elements;
 
+        if (m_deleted[pos])
+        {
+          m_deleted[pos] = false;
+          --m_tombstones;
+        }
+
         if (pos < m_first)
         {
           m_first = pos;
@@ -418,10 +627,12 @@ namespace earley
         HashSetIterator<T, Mapping, Hash, Equality>(this, pos), inserted);
     }
 
+    // Move everything to a table of at least `size` slots, which drops the
+    // tombstones.
     void
-    resize()
+    rehash(size_t size)
     {
-      HashTable<T, Mapping, Hash, Equality> moved(m_size * 2 + 1);
+      HashTable<T, Mapping, Hash, Equality> moved(size, m_resource);
 
       for (size_t i = 0; i != m_size; ++i)
       {
@@ -432,6 +643,8 @@ namespace earley
         }
       }
 
+      moved.m_stats = m_stats;
+      moved.m_stats.resized();
       swap(moved);
     }
 
@@ -440,22 +653,32 @@ namespace earley
     {
       std::swap(other.m_memory, m_memory);
       std::swap(other.m_elements, m_elements);
+      std::swap(other.m_tombstones, m_tombstones);
       std::swap(other.m_occupied, m_occupied);
+      std::swap(other.m_deleted, m_deleted);
       std::swap(other.m_first, m_first);
       std::swap(other.m_size, m_size);
+      std::swap(other.m_resource, m_resource);
+      std::swap(other.m_stats, m_stats);
     }
 
     friend class HashSetIterator<T, Mapping, Hash, Equality>;
 
     size_t m_elements;
+    size_t m_tombstones = 0;
     size_t m_size;
     size_t m_first;
-    std::vector<bool> m_occupied;
+    std::pmr::vector<bool> m_occupied;
+    std::pmr::vector<bool> m_deleted;
     Storage* m_memory;
+    std::pmr::memory_resource* m_resource;
+    mutable HashStats m_stats;
   };
 
   template <typename Key, typename Value, typename... Args>
   using HashMap = HashTable<Key, Value, Args...>;
 }
 
+#include "earley/group_hash_table.hpp"
+
 #endif
@@ -0,0 +1,109 @@
+#include "earley/fast/compiled.hpp"
+#include "earley/fast.hpp"
+
+#include <algorithm>
+
+namespace earley::fast
+{
+
+CompiledGrammar::CompiledGrammar(grammar::Grammar grammar)
+: m_grammar(std::move(grammar))
+, m_items(m_grammar.all_rules(),
+    m_grammar.first_sets(),
+    m_grammar.follow_sets(),
+    m_grammar.nullable_set())
+, m_cores(std::make_unique<CoreCache>(*this))
+{
+  build_predictions();
+}
+
+CompiledGrammar::CompiledGrammar(const GrammarTables& tables)
+: m_grammar(tables)
+, m_items(m_grammar.all_rules(), tables)
+, m_cores(std::make_unique<CoreCache>(*this))
+, m_prediction_offsets(tables.prediction_offsets,
+    tables.prediction_offsets + tables.nonterminals + 1)
+{
+  m_predictions.reserve(m_prediction_offsets.back());
+  for (size_t i = 0; i != m_prediction_offsets.back(); ++i)
+  {
+    m_predictions.push_back(m_items.item(tables.predictions[i]));
+  }
+}
+
+CompiledGrammar::~CompiledGrammar() = default;
+
+void
+CompiledGrammar::build_predictions()
+{
+  auto& all_rules = m_grammar.all_rules();
+
+  // Which items and nonterminals the current closure has, by the
+  // nonterminal it is for.
+  std::vector<size_t> item_closure(m_items.items(), all_rules.size());
+  std::vector<size_t> predicted(all_rules.size(), all_rules.size());
+
+  m_prediction_offsets.push_back(0);
+
+  for (size_t nonterminal = 0; nonterminal != all_rules.size(); ++nonterminal)
+  {
+    auto begin = m_predictions.size();
+
+    auto add = [&](const Item* item) {
+      if (item_closure[item->index()] != nonterminal)
+      {
+        item_closure[item->index()] = nonterminal;
+        m_predictions.push_back(item);
+      }
+    };
+
+    auto predict = [&](size_t symbol) {
+      if (predicted[symbol] != nonterminal)
+      {
+        predicted[symbol] = nonterminal;
+        for (auto& rule: all_rules[symbol])
+        {
+          add(m_items.get_item(&rule, 0));
+        }
+      }
+    };
+
+    predict(nonterminal);
+
+    for (auto i = begin; i != m_predictions.size(); ++i)
+    {
+      auto item = m_predictions[i];
+      if (item->complete())
+      {
+        continue;
+      }
+
+      auto& symbol = *item->dot();
+      if (!symbol.terminal)
+      {
+        predict(symbol.index);
+
+        if (m_grammar.nullable(symbol.index))
+        {
+          add(item->next());
+        }
+      }
+    }
+
+    m_prediction_offsets.push_back(m_predictions.size());
+  }
+}
+
+std::shared_ptr<const CompiledGrammar>
+compile(grammar::Grammar grammar)
+{
+  return std::make_shared<const CompiledGrammar>(std::move(grammar));
+}
+
+std::shared_ptr<const CompiledGrammar>
+compile(const GrammarTables& tables)
+{
+  return std::make_shared<const CompiledGrammar>(tables);
+}
+
+}
@@ -0,0 +1,208 @@
+#include "earley/fast.hpp"
+
+#include <algorithm>
+#include <mutex>
+
+namespace earley::fast
+{
+
+CoreCache::CoreCache(const CompiledGrammar& grammar)
+: m_grammar(grammar)
+, m_core_hash(1000)
+, m_item_stamps(grammar.items(), 0)
+, m_predicted(grammar.grammar().all_rules().size(), 0)
+{
+}
+
+ItemSetCore*
+CoreCache::intern(const ItemSetCore& core)
+{
+  {
+    std::shared_lock lock(m_mutex);
+    auto iter = m_core_hash.find(const_cast<ItemSetCore*>(&core));
+    if (iter != m_core_hash.end())
+    {
+      return *iter;
+    }
+  }
+
+  std::unique_lock lock(m_mutex);
+
+  // Someone else could have added it while we were waiting for the lock.
+  auto iter = m_core_hash.find(const_cast<ItemSetCore*>(&core));
+  if (iter != m_core_hash.end())
+  {
+    return *iter;
+  }
+
+  auto& interned = m_cores.emplace_back(m_arenas);
+  interned.number(m_cores.size() - 1);
+
+  for (auto item: core.start_item_list())
+  {
+    interned.add_start_item(item);
+  }
+
+  expand(&interned);
+  interned.finalise();
+  build_transitions(&interned);
+
+  m_core_hash.insert(&interned);
+
+  return &interned;
+}
+
+CoreCache::Transitions
+CoreCache::transitions(const ItemSetCore* core, grammar::Symbol symbol) const
+{
+  return core->transitions(symbol);
+}
+
+size_t
+CoreCache::size() const
+{
+  std::shared_lock lock(m_mutex);
+  return m_cores.size();
+}
+
+void
+__attribute__((noinline))
+CoreCache::expand(ItemSetCore* core)
+{
+  ++m_stamp;
+  m_scratch_transitions.clear();
+  add_empty_symbol_items(core);
+  add_non_start_items(core);
+}
+
+bool
+CoreCache::nullable(const grammar::Symbol& symbol) const
+{
+  return !symbol.terminal && m_grammar.nullable(symbol.index);
+}
+
+void
+CoreCache::add_empty_symbol_items(ItemSetCore* core)
+{
+  // for each item in the start items, add the next items
+  // as long as the right hand sides can derive empty
+  for (size_t i = 0; i != core->start_items(); ++i)
+  {
+    for (
+      auto item = core->item(i);
+      !item->complete() && nullable(*item->dot());
+      item = item->next())
+    {
+      core->add_derived_item(item->next(), i);
+      m_item_stamps[item->next()->index()] = m_stamp;
+    }
+  }
+}
+
+void
+CoreCache::add_non_start_items(ItemSetCore* core)
+{
+  for (size_t i = 0; i < core->all_items(); ++i)
+  {
+    item_transition(core, core->item(i), i);
+  }
+}
+
+void
+CoreCache::insert_transitions(ItemSetCore*,
+  const grammar::Symbol& symbol, size_t index)
+{
+  m_scratch_transitions.push_back({ItemSetCore::transition_key(symbol),
+    index});
+}
+
+// Group the transitions of `core` by their symbol, into one sorted table of
+// symbols and one array of item indexes.
+void
+CoreCache::build_transitions(ItemSetCore* core)
+{
+  // The items were added in order, so a stable sort keeps each symbol's
+  // items in order too.
+  std::stable_sort(m_scratch_transitions.begin(), m_scratch_transitions.end(),
+    [](auto& a, auto& b) { return a.first < b.first; });
+
+  auto items = m_transition_items.start();
+  auto ranges = m_transition_ranges.start();
+
+  uint32_t begin = 0;
+  for (uint32_t i = 0; i != m_scratch_transitions.size(); ++i)
+  {
+    items = m_transition_items.emplace_back(m_scratch_transitions[i].second);
+
+    if (i + 1 == m_scratch_transitions.size() ||
+      m_scratch_transitions[i + 1].first != m_scratch_transitions[i].first)
+    {
+      ranges = m_transition_ranges.emplace_back(ItemSetCore::Transition{
+        m_scratch_transitions[i].first, begin, i + 1});
+      begin = i + 1;
+    }
+  }
+
+  auto count = m_transition_ranges.top_size();
+  m_transition_items.finalise();
+  m_transition_ranges.finalise();
+
+  core->set_transitions(ranges, count, items);
+}
+
+// If this item has a symbol after the dot, add an index for
+// (current item set, item->symbol) -> item
+void
+CoreCache::item_transition(ItemSetCore* core, const PItem* item, size_t index)
+{
+  if (!item->complete())
+  {
+    auto& symbol = *item->dot();
+
+    // prediction
+    if (!is_terminal(symbol) && m_predicted[symbol.index] != m_stamp)
+    {
+      add_predictions(core, symbol.index);
+    }
+
+    insert_transitions(core, symbol, index);
+
+    // if this symbol can derive empty then add the next item too
+    if (nullable(symbol))
+    {
+      // nullable completion
+      add_initial_item(core, item->next());
+    }
+  }
+}
+
+void
+CoreCache::add_initial_item(ItemSetCore* core, const PItem* item)
+{
+  // add the item if it doesn't already exist
+  if (m_item_stamps[item->index()] != m_stamp)
+  {
+    m_item_stamps[item->index()] = m_stamp;
+    core->add_initial_item(item);
+  }
+}
+
+// Add everything that predicting `nonterminal` adds, and remember what it
+// predicted so that none of it is added again.
+void
+CoreCache::add_predictions(ItemSetCore* core, int nonterminal)
+{
+  m_predicted[nonterminal] = m_stamp;
+
+  for (auto item: m_grammar.predictions(nonterminal))
+  {
+    if (!item->complete() && !item->dot()->terminal)
+    {
+      m_predicted[item->dot()->index] = m_stamp;
+    }
+
+    add_initial_item(core, item);
+  }
+}
+
+}
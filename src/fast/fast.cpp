@@ -2,7 +2,10 @@
 #include "earley/grammar_util.hpp"
 #include "earley/util.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <limits>
+#include <stdexcept>
 
 namespace earley::fast
 {
@@ -10,27 +13,8 @@ namespace earley::fast
 namespace
 {
 
-  template <typename T>
-  void
-  insert_unique(std::vector<T>& c, const T& v)
-  {
-    auto iter = std::find(c.begin(), c.end(), v);
-
-    if (iter == c.end())
-    {
-      c.push_back(v);
-    }
-  }
-
-  template <typename T>
-  auto
-  insert_unique(HashSet<T>& c, const T& v)
-  {
-    return c.insert(v);
-  }
-
   bool
-  compare_lookahead_sets(std::vector<ItemSet*>& item_sets,
+  compare_lookahead_sets(std::pmr::vector<ItemSet*>& item_sets,
     ItemSet* a, int place, int position)
   {
     auto& da = a->distances();
@@ -46,47 +30,40 @@ namespace
     return true;
   }
 
-  bool
-  in_item_set(const Item* item, const ItemSet* set)
+  size_t
+  input_size(const TerminalList* tokens)
+  {
+    return tokens != nullptr ? tokens->size() : 0;
+  }
+
+#ifdef EARLEY_HASH_STATS
+  template <typename Table>
+  void
+  print_table_stats(const char* name, const Table& table)
   {
-    auto core = set->core();
-    auto items = core->items();
-    return std::find(items.begin(), items.end(), item) != items.end();
+    auto& stats = table.stats();
+    std::cout << name << ": " << table.size() << " in "
+      << table.capacity() << " slots (load " << table.load_factor()
+      << "), " << stats.lookups << " lookups, " << stats.probes
+      << " extra probes, longest " << stats.longest_probe << ", "
+      << stats.resizes << " resizes" << std::endl;
   }
+#endif
 }
 
 void
 Parser::unique_insert_start_item(
   ItemSet* set,
   const Item* item,
-  int distance,
-  int position
+  int distance
 )
 {
-  // We are only ever looking at the latest set, so a neat optimisation
-  // here is to keep a single structure called `membership`, which is a map
-  // of item -> array of position.
-  // When we insert an item with a distance `distance`, when parsing token
-  // `position`, then we set
-  //   membership[item][distance] = position
-  // Then if `membership[item][distance] == position` we know that we have
-  // already added that item.
-  // Otherwise `membership[item][distance]` will always be less than position.
-
-  auto& dots = m_item_membership[item->index()];
-  if (dots.size() <= static_cast<size_t>(distance))
-  {
-    // micro optimisation: we don't know how big this distance could ever be
-    // so double the distance to reduce allocations sometimes
-    dots.resize((distance+1)*2);
-  }
-  else if (dots[distance] == static_cast<size_t>(position))
+  // We are only ever looking at the latest set, so the membership only has
+  // to know about the (item, distance) pairs in this set.
+  if (m_membership.insert(item->index(), distance))
   {
-    return;
+    set->add_start_item(item, distance);
   }
-
-  dots[distance] = position;
-  set->add_start_item(item, distance);
 }
 
 grammar::Symbol
@@ -105,26 +82,56 @@ ItemSet::add_start_item(const PItem* item, size_t distance)
   m_distances.append(distance);
 }
 
-Parser::Parser(const grammar::Grammar& grammar_new, const TerminalList& tokens)
-: m_grammar_new(grammar_new)
+Parser::Parser(const grammar::Grammar& grammar, const TerminalList& tokens,
+  std::pmr::memory_resource* resource)
+: Parser(compile(grammar), tokens, resource)
+{
+}
+
+Parser::Parser(std::shared_ptr<const CompiledGrammar> grammar,
+  const TerminalList& tokens, std::pmr::memory_resource* resource)
+: Parser(*grammar, tokens, resource)
+{
+  m_grammar_owner = std::move(grammar);
+}
+
+Parser::Parser(const CompiledGrammar& grammar, const TerminalList& tokens,
+  std::pmr::memory_resource* resource)
+: Parser(grammar, &tokens, resource)
+{
+}
+
+Parser::Parser(std::shared_ptr<const CompiledGrammar> grammar,
+  std::pmr::memory_resource* resource)
+: Parser(*grammar, resource)
+{
+  m_grammar_owner = std::move(grammar);
+}
+
+Parser::Parser(const CompiledGrammar& grammar,
+  std::pmr::memory_resource* resource)
+: Parser(grammar, nullptr, resource)
+{
+}
+
+Parser::Parser(const CompiledGrammar& grammar, const TerminalList* tokens,
+  std::pmr::memory_resource* resource)
+: m_grammar(grammar)
 , m_tokens(tokens)
-, m_item_set_hash(tokens.size() < 20000 ? 20000 : tokens.size() / 5)
-, m_set_symbols(tokens.size() < 20000 ? 20000 : tokens.size())
-, m_set_term_lookahead(tokens.size() < 30000 ? 30000 : tokens.size())
-, m_distance_hash(tokens.size() < 20000 ? 20000 : tokens.size() / 5)
-, m_all_items(m_grammar_new.all_rules(),
-    m_grammar_new.first_sets(),
-    m_grammar_new.follow_sets(),
-    m_grammar_new.nullable_set())
-{
-  m_item_membership.resize(m_all_items.items());
-
-  // this needs to be large enough to not reallocate, since we store pointers
-  // to these. I think we only end up with tokens + 1 sets.
-  m_setOwner.reserve(tokens.size() + 1);
-  m_coreOwner.reserve(tokens.size() + 1);
-
-  m_itemSets.reserve(tokens.size()+1);
+, m_resource(resource)
+, m_arenas(resource)
+, m_itemSets(resource)
+, m_item_set_hash(20000, resource)
+, m_setOwner(64, resource)
+, m_scratch_core(m_arenas.cores)
+, m_set_term_lookahead(30000, resource)
+, m_forest(resource)
+, m_distance_hash(20000, resource)
+, m_membership(8, resource)
+, m_set_epochs(resource)
+{
+  m_itemSets.reserve(input_size(tokens) + 1);
+  m_set_epochs.reserve(input_size(tokens) + 1);
   create_start_set();
 }
 
@@ -132,302 +139,426 @@ void
 Parser::parse_input()
 {
   size_t position = 0;
-  while (position < m_tokens.size())
+  while (position < m_tokens->size())
   {
     parse(position);
     ++position;
   }
 
-  std::cout << "reused " << m_reuse << std::endl;
-  std::cout << m_tokens.size() << " tokens" << std::endl;
+  std::cout << "reused " << m_goto_stats.hits << std::endl;
+  std::cout << m_tokens->size() << " tokens" << std::endl;
 }
 
 void
 Parser::parse(size_t position)
 {
-  auto token = m_tokens[position];
-  auto lookahead = position < m_tokens.size()-1
-    ? m_tokens[position+1]
-    : -1;
+  auto& tokens = *m_tokens;
+  int lookahead = position < tokens.size()-1
+    ? static_cast<int>(tokens[position+1])
+    : int(grammar::END_OF_INPUT);
 
-  auto lookahead_hash = m_set_term_lookahead.insert(
-    SetTermLookahead(
-      m_itemSets[position],
-      token,
-      lookahead));
+  if (!advance(position, tokens[position], lookahead))
+  {
+    fail(position, tokens[position]);
+  }
+}
 
-  if (!lookahead_hash.second)
+void
+Parser::feed(size_t token)
+{
+  if (m_pending)
   {
-    if (lookahead_hash.first->goto_count > 0)
+    auto position = m_itemSets.size() - 1;
+    if (!advance(position, *m_pending, token))
     {
-      int which = 0;
-      while (which < lookahead_hash.first->goto_count)
-      {
-        auto place = lookahead_hash.first->place[which];
-        if (compare_lookahead_sets(m_itemSets, lookahead_hash.first->goto_sets[which],
-          place, position))
-        {
-          ++m_reuse;
-          m_itemSets.push_back(m_itemSets[place]);
-          return;
-        }
-        ++which;
-      }
+      fail(position, *m_pending);
     }
-    ++m_lookahead_collisions;
   }
 
-  auto set = create_new_set(position, m_tokens);
+  m_pending = token;
+}
 
-  auto core_hash = m_set_core_hash.insert(set->core());
+bool
+Parser::finish()
+{
+  if (m_pending)
+  {
+    auto position = m_itemSets.size() - 1;
+    if (!advance(position, *m_pending, grammar::END_OF_INPUT))
+    {
+      fail(position, *m_pending);
+    }
+    m_pending.reset();
+  }
 
-  auto distance_hash = m_distance_hash.insert(set->distances());
+  return accepted();
+}
 
-  if (!distance_hash.second)
+std::optional<ParseError>
+Parser::recognise()
+{
+  if (m_tokens == nullptr)
   {
-    set->distances().reset();
-    set->set_distance(*distance_hash.first);
+    throw std::logic_error("recognise needs the input up front, "
+      "use finish for a streamed input");
   }
-  else
+
+  auto& tokens = *m_tokens;
+  for (auto position = m_itemSets.size() - 1; position < tokens.size();
+    ++position)
   {
-    set->distances().finalise();
+    int lookahead = position < tokens.size()-1
+      ? static_cast<int>(tokens[position+1])
+      : int(grammar::END_OF_INPUT);
+
+    if (!advance(position, tokens[position], lookahead))
+    {
+      return ParseError{position, m_itemSets[position]};
+    }
   }
 
-  if (!core_hash.second)
+  if (!accepted())
   {
-    set->set_core(*core_hash.first);
-    m_core_reset = true;
+    return ParseError{tokens.size(), m_itemSets.back()};
   }
 
-  set->finalise();
-
-  // if this is a new set, then expand it
-  //auto copy = *set;
-  auto result = m_item_set_hash.insert(set);
+  return std::nullopt;
+}
 
-  if (!result.second)
+size_t
+Parser::reparse(size_t begin, size_t end, const TerminalList& tokens)
+{
+  if (m_tokens == nullptr)
   {
-    reset_set();
+    throw std::logic_error("reparse needs the input up front, "
+      "it can't be used on a streamed input");
   }
 
-  if (core_hash.second)
-  {
-    expand_set(&result.first->get());
-  }
+  auto parsed = m_itemSets.size() - 1;
 
-  // keeping the most recent set here seems to increase reuse a bit
-  auto& goto_count = lookahead_hash.first->goto_count;
-  lookahead_hash.first->goto_sets[goto_count] = &result.first->get();
-  lookahead_hash.first->place[goto_count] = position+1;
-  goto_count = (goto_count+1) % MAX_LOOKAHEAD_SETS;
+  // The set at `begin` was made with the first replaced token as its
+  // lookahead, so start from the token before.
+  auto start = begin == 0 ? 0 : begin - 1;
 
-  if (core_hash.second)
+  // In the new input, the tokens after the edit start here.
+  auto new_end = end + tokens.size() - m_tokens->size();
+  bool same_length = new_end == end;
+  m_tokens = &tokens;
+
+  if (parsed < end)
   {
-    (*core_hash.first)->finalise();
+    // There is nothing after the edit to reuse, so parse the rest.
+    truncate_sets(std::min(parsed, start) + 1);
+
+    size_t reparsed = 0;
+    for (auto position = m_itemSets.size() - 1; position != tokens.size();
+      ++position)
+    {
+      parse(position);
+      ++reparsed;
+    }
+
+    return reparsed;
   }
-  m_itemSets.push_back(&result.first->get());
-}
 
-void
-Parser::create_start_set()
-{
-  auto& core = m_coreOwner.emplace_back();
-  auto items = &m_setOwner.emplace_back(&core);
+  // The sets from the end of the edit in the old input.
+  std::pmr::vector<ItemSet*> old_sets(m_itemSets.begin() + end,
+    m_itemSets.end(), m_resource);
+  truncate_sets(start + 1);
+
+  auto last = parsed - end + new_end;
+
+  // The old sets after the edit can be used again once the new sets are
+  // the same as the old ones for a run of positions, and every item in that
+  // run started inside the run. Then every set that parsing the rest of the
+  // input would look at is the same as before.
+  // Items that started before the edit are fine too when the length of the
+  // input didn't change, since their distances point at the same sets.
+  size_t run_start = new_end;
+  size_t lowest_origin = std::numeric_limits<size_t>::max();
+  size_t reparsed = 0;
 
-  for (auto& rule: m_grammar_new.rules(m_grammar_new.start()))
+  if (new_end <= start && m_itemSets[new_end] != old_sets.front())
   {
-    auto item = get_item(&rule, 0);
-    items->add_start_item(item, 0);
+    run_start = new_end + 1;
   }
 
-  expand_set(items);
+  for (size_t position = start; position != last; ++position)
+  {
+    parse(position);
+    ++reparsed;
 
-  m_itemSets.push_back(items);
-  m_item_set_hash.insert(items);
+    auto current = position + 1;
+    if (current < new_end)
+    {
+      continue;
+    }
 
-  core.finalise();
-  items->distances().finalise();
-  items->finalise();
+    auto set = m_itemSets[current];
+    if (set != old_sets[current - new_end])
+    {
+      run_start = current + 1;
+      lowest_origin = std::numeric_limits<size_t>::max();
+      continue;
+    }
+
+    auto& distances = set->distances();
+    for (size_t i = 0; i != set->core()->start_items(); ++i)
+    {
+      auto origin = current - distances[i];
+      if ((origin > start || !same_length) && origin < lowest_origin)
+      {
+        lowest_origin = origin;
+      }
+    }
+
+    if (lowest_origin >= run_start)
+    {
+      for (auto iter = old_sets.begin() + (current - new_end) + 1;
+        iter != old_sets.end(); ++iter)
+      {
+        push_set(*iter);
+      }
+      break;
+    }
+  }
+
+  return reparsed;
 }
 
-void
-__attribute__((noinline))
-Parser::expand_set(ItemSet* items)
+Parser::Checkpoint
+Parser::checkpoint() const
 {
-  add_empty_symbol_items(items);
-  add_non_start_items(items);
+  return Checkpoint{m_itemSets.size(), m_set_epochs.back(), m_pending};
 }
 
-const Item*
-Parser::get_item(const grammar::Rule* rule, int dot)
+void
+Parser::rollback(const Checkpoint& checkpoint)
 {
-  return m_all_items.get_item(rule, dot);
+  // If the last set at the checkpoint has been replaced, then everything
+  // after it could have been too.
+  if (checkpoint.sets > m_itemSets.size() ||
+    m_set_epochs[checkpoint.sets - 1] != checkpoint.epoch)
+  {
+    throw StaleCheckpoint();
+  }
+
+  // The sets that are thrown away stay in the set hash, they don't depend
+  // on where they were made and could be found again by a later parse.
+  truncate_sets(checkpoint.sets);
+  m_pending = checkpoint.pending;
 }
 
-void
-Parser::add_empty_symbol_items(ItemSet* items)
+bool
+Parser::accepted() const
 {
-  auto core = items->core();
+  auto end = m_itemSets.size() - 1;
+  auto set = m_itemSets[end];
+  auto core = set->core();
 
-  // for each item in the start items, add the next items
-  // as long as the right hand sides can derive empty
-  for (size_t i = 0; i != core->start_items(); ++i)
+  for (size_t i = 0; i != core->all_items(); ++i)
   {
     auto item = core->item(i);
-    for (
-      auto pos = item->dot();
-      pos != item->rule().end() && nullable(*pos);
-      ++pos)
+    if (item->nonterminal() == m_grammar.start() &&
+        item->complete() &&
+        set->actual_distance(i) == end)
     {
-      items->add_derived_item(
-        get_item(&item->rule(), (pos + 1) - item->rule().begin()),
-        i);
+      return true;
     }
   }
+
+  return false;
 }
 
-void
-Parser::add_non_start_items(ItemSet* items)
+bool
+Parser::advance(size_t position, size_t token, int lookahead)
 {
-  auto core = items->core();
-  for (size_t i = 0; i < core->all_items(); ++i)
+  auto lookahead_hash = m_set_term_lookahead.insert(
+    SetTermLookahead(
+      m_itemSets[position],
+      token,
+      lookahead));
+
+  // Only the arrow gives the gotos, which aren't part of the key, mutably.
+  auto& gotos = *lookahead_hash.first.operator->();
+
+  for (int which = 0; which != gotos.count; ++which)
   {
-    item_transition(items, core->item(i), i);
+    auto& cached = gotos.gotos[which];
+    if (current_place(cached.place, cached.epoch) &&
+      compare_lookahead_sets(m_itemSets, cached.set, cached.place, position))
+    {
+      ++m_goto_stats.hits;
+      if (gotos.hits != std::numeric_limits<uint16_t>::max())
+      {
+        ++gotos.hits;
+      }
+
+      // Move it to the front, so the one at the back is the least recently
+      // used.
+      std::rotate(gotos.gotos, gotos.gotos + which,
+        gotos.gotos + which + 1);
+      push_set(gotos.gotos[0].set);
+      return true;
+    }
   }
 
-  //for (size_t i = 0; i < core->all_items(); ++i)
-  //{
-  //  auto item = core->item(i);
-  //  if (item->dot() == item->end())
-  //  {
-  //    item_completion(items, item, i);
-  //  }
-  //}
-}
+  ++m_goto_stats.misses;
 
-void
-Parser::insert_transitions(ItemSetCore* core,
-  const grammar::Symbol& symbol, size_t index)
-{
-  SetSymbolRules tuple(core, symbol);
-  auto result = insert_transition(tuple);
-  result.first->second.push_back(index);
-}
+  auto set = create_new_set(position, token, lookahead);
 
-// If this item has a symbol after the dot, add an index for
-// (current item set, item->symbol) -> item
-void
-Parser::item_transition(ItemSet* items, const PItem* item, size_t index)
-{
-  auto& rule = item->rule();
-  auto core = items->core();
+  if (set == nullptr)
+  {
+    return false;
+  }
+
+  // This expands the core if no parse has needed it before.
+  set->set_core(m_grammar.cores().intern(m_scratch_core));
+
+  auto distance_hash = m_distance_hash.insert(set->distances());
+
+  if (!distance_hash.second)
+  {
+    set->distances().reset();
+    set->set_distance(*distance_hash.first);
+  }
+  else
+  {
+    set->distances().finalise();
+  }
+
+  set->finalise();
+
+  // if this is a new set, then expand it
+  //auto copy = *set;
+  auto result = m_item_set_hash.insert(set);
 
-  if (item->dot() != rule.end())
+  if (!result.second)
   {
-    auto& symbol = *item->dot();
+    reset_set();
+  }
 
-    if (is_terminal(symbol))
+  if (gotos.count == gotos.ways)
+  {
+    if (gotos.evictions != std::numeric_limits<uint16_t>::max())
     {
-      insert_transitions(items->core(), symbol, index);
+      ++gotos.evictions;
     }
-    else
+
+    // This key is seen in more contexts than it has room for.
+    if (gotos.evictions > gotos.hits && gotos.ways != MAX_GOTO_WAYS)
     {
-      SetSymbolRules tuple(core, get_symbol(symbol));
-      auto [iter, inserted] = insert_transition(tuple);
-      if (inserted)
-      {
-        // prediction
-        // insert initial items for this symbol
-        for (auto& prediction: m_grammar_new.rules(get_terminal(symbol)))
-        {
-          add_initial_item(core, get_item(&prediction, 0));
-        }
-      }
-      iter->second.push_back(index);
+      gotos.ways *= 2;
+      gotos.hits = 0;
+      gotos.evictions = 0;
+      ++m_goto_stats.grown;
     }
-
-    // if this symbol can derive empty then add the next item too
-    if (nullable(symbol) && item->dot() != rule.end())
+    else
     {
-      // nullable completion
-      add_initial_item(core, get_item(&rule, item->dot() - rule.begin() + 1));
+      ++m_goto_stats.evictions;
+      --gotos.count;
     }
   }
+
+  // keeping the most recent set here seems to increase reuse a bit
+  std::move_backward(gotos.gotos, gotos.gotos + gotos.count,
+    gotos.gotos + gotos.count + 1);
+  gotos.gotos[0] = {&result.first->get(), static_cast<int>(position + 1),
+    static_cast<uint32_t>(m_epoch)};
+  ++gotos.count;
+
+  push_set(&result.first->get());
+
+  return true;
 }
 
 void
-Parser::item_completion(ItemSet*, const PItem*, size_t)
+Parser::push_set(ItemSet* set)
 {
-  // Completion in the current set:
-  // Find the rules that predicted the lhs of this rule in the current set
-  //SetSymbolRules tuple{items->core(), item->rule().nonterminal(), {}};
-  //auto iter = m_set_symbols.find(tuple);
+  m_itemSets.push_back(set);
+  m_set_epochs.push_back(m_epoch);
+}
 
-  //assert(iter != m_set_symbols.end());
-};
+void
+Parser::truncate_sets(size_t size)
+{
+  m_itemSets.resize(size);
+  m_set_epochs.resize(size);
+  ++m_epoch;
+}
 
-auto
-Parser::insert_transition(const SetSymbolRules& tuple)
--> decltype(m_set_symbols.emplace(tuple))
+bool
+Parser::current_place(size_t place, size_t epoch) const
 {
-  //std::cout << "Inserting (" << tuple.set << ", (" << tuple.symbol.index << ", " << tuple.symbol.terminal << "))" << std::endl;
-  return m_set_symbols.emplace(tuple);
+  // The sets from `place` onwards are thrown away when the input is
+  // truncated, so if the set at `place` is from the same epoch then so are
+  // all the sets before it, and they are the ones the goto set came from.
+  return place < m_itemSets.size() && m_set_epochs[place] == epoch;
 }
 
 void
-Parser::add_initial_item(ItemSetCore* core, const PItem* item)
+Parser::create_start_set()
 {
-  // add the item if it doesn't already exist
-  for (size_t i = core->start_items(); i != core->all_items(); ++i)
+  auto items = &m_setOwner.emplace_back(&m_scratch_core, m_arenas);
+
+  for (auto& rule: m_grammar.rules(m_grammar.start()))
   {
-    if (item == core->item(i))
-    {
-      return;
-    }
+    auto item = get_item(&rule, 0);
+    items->add_start_item(item, 0);
   }
 
-  core->add_initial_item(item);
+  items->set_core(m_grammar.cores().intern(m_scratch_core));
+
+  push_set(items);
+  m_item_set_hash.insert(items);
+
+  items->distances().finalise();
+  items->finalise();
+}
+
+const Item*
+Parser::get_item(const grammar::Rule* rule, int dot)
+{
+  return m_grammar.get_item(rule, dot);
 }
 
 // Do scans and completions to start the current set
 // find it in the hash table, then expand it if it's new
 ItemSet*
-Parser::create_new_set(size_t position, const TerminalList& input)
+Parser::create_new_set(size_t position, size_t symbol, int lookahead)
 {
-  auto symbol = input[position];
   auto token = create_token(symbol);
-  auto& core = next_core();
+  auto& core = m_scratch_core;
+  core.reset();
   auto current_set = &next_set(&core);
+  m_membership.next();
 
   auto previous_set = m_itemSets[position];
   auto& previous_core = *previous_set->core();
 
+  auto& cores = m_grammar.cores();
+
+  // The items that the lookahead allows.
+  auto admissible = m_grammar.admissible(lookahead);
+
   // look up the symbol index for the previous set
-  auto scans = m_set_symbols.find(SetSymbolRules(
-    &previous_core, token));
+  auto scans = cores.transitions(&previous_core, token);
 
-  if (scans != m_set_symbols.end())
+  if (scans.begin() != scans.end())
   {
     // do all the scans
-    for (auto transition: scans->second)
+    for (auto transition: scans)
     {
       auto item = previous_core.item(transition);
-      auto next = get_item(&item->rule(), item->dot_index() + 1);
+      auto next = item->next();
 
-      if (position < input.size()-1 &&
-          !next->in_lookahead(input[position+1]))
+      if (!CompiledGrammar::admits(admissible, next->index()))
       {
         continue;
       }
 
       unique_insert_start_item(current_set, next,
-        previous_set->actual_distance(transition)+1, position);
-
-      //auto pointers = m_item_tree.insert({next,
-      //  current_set,
-      //  previous_set->actual_distance(transition) + 1,
-      //});
-      //insert_unique(pointers.first->predecessor, item);
+        previous_set->actual_distance(transition)+1);
     }
 
     // now do all the completed items
@@ -445,17 +576,17 @@ Parser::create_new_set(size_t position, const TerminalList& input)
 
         // find the symbol for the lhs of this rule in set that predicted this
         // i.e., this is a completion: find the items it completes
-        auto transitions = m_set_symbols.find(SetSymbolRules(
+        auto transitions = cores.transitions(
           from_core,
           {item->rule().nonterminal(), false}
-        ));
+        );
 
-        if (transitions == m_set_symbols.end())
+        if (transitions.begin() == transitions.end())
         {
-          if (item->rule().nonterminal() != m_grammar_new.start())
+          if (item->rule().nonterminal() != m_grammar.start())
           {
             //TODO: clean this up
-            auto& names = m_grammar_new.names();
+            auto& names = m_grammar.names();
             std::cerr << "At position " << position << ", Completing item: ";
             item->print(std::cerr, {names.begin(), names.end()});
             std::cerr << ": " << current_set->distance(i) << std::endl;
@@ -473,21 +604,19 @@ Parser::create_new_set(size_t position, const TerminalList& input)
           continue;
         }
 
-        for (auto transition: transitions->second)
+        for (auto transition: transitions)
         {
           auto* titem = from_core->item(transition);
-          auto* next = get_item(&titem->rule(),
-            titem->dot() - titem->rule().begin() + 1);
+          auto* next = titem->next();
 
-          if (position < input.size()-1 &&
-              !next->in_lookahead(input[position+1]))
+          if (!CompiledGrammar::admits(admissible, next->index()))
           {
             continue;
           }
 
           auto transition_distance = from_set->actual_distance(transition) + distance;
           unique_insert_start_item(current_set, next,
-            transition_distance, position);
+            transition_distance);
 
           // If we are actually at the end, then add a reduction
           // We can do this later, once for each unique set
@@ -495,24 +624,25 @@ Parser::create_new_set(size_t position, const TerminalList& input)
           // can take every completed item t, find the item that predicted it q,
           // create the next item p, then make a reduction pointer p to t, and 
           // a predecessor pointer p to q.
-#if 0
-          if (item->position() == item->end())
-          {
-            auto pointers = m_item_tree.insert({next, current_set,
-              from_set->actual_distance(transition) + distance});
-            insert_unique(pointers.first->reduction, item);
-            insert_unique(pointers.first->predecessor, titem);
-          }
-#endif
         }
       }
     }
   }
   else
   {
-    std::cerr << "Couldn't find token " << symbol << " in set " << position << std::endl;
-    parse_error(position);
-    throw "Parse error";
+    // Nothing has been added, so the set can be used for the next one.
+    current_set->distances().reset();
+    m_set_reset = true;
+    return nullptr;
+  }
+
+  if (core.start_items() == 0 && lookahead != grammar::END_OF_INPUT)
+  {
+    // The lookahead filtered out everything, so the next token is an error.
+    // Make the set without the filter so the error knows what was expected.
+    current_set->distances().reset();
+    m_set_reset = true;
+    return create_new_set(position, symbol, grammar::END_OF_INPUT);
   }
 
   return current_set;
@@ -522,7 +652,7 @@ void
 Parser::print_set(size_t i)
 {
   auto set = m_itemSets.at(i);
-  auto& names = m_grammar_new.names();
+  auto& names = m_grammar.names();
   set->print({names.begin(), names.end()});
 }
 
@@ -558,17 +688,45 @@ ItemSet::print(const std::unordered_map<size_t, std::string>& names) const
 }
 
 void
-Parser::parse_error(size_t i)
+Parser::fail(size_t position, size_t token)
+{
+  std::cerr << "Couldn't find token " << token << " in set " << position << std::endl;
+  print_error(ParseError{position, m_itemSets[position]}, std::cout);
+  throw "Parse error";
+}
+
+std::vector<size_t>
+Parser::expected(const ParseError& error) const
+{
+  std::vector<size_t> terminals;
+
+  for (auto item: error.set->core()->items())
+  {
+    auto symbol = item->position();
+    if (symbol != item->end() && symbol->terminal)
+    {
+      terminals.push_back(symbol->index);
+    }
+  }
+
+  std::sort(terminals.begin(), terminals.end());
+  terminals.erase(std::unique(terminals.begin(), terminals.end()),
+    terminals.end());
+
+  return terminals;
+}
+
+void
+Parser::print_error(const ParseError& error, std::ostream& out) const
 {
   //failed here
-  std::cout << "Parse error at " << i << ", expecting: START";
+  out << "Parse error at " << error.position << ", expecting: START";
 
-  auto& names = m_grammar_new.names();
+  auto& names = m_grammar.names();
   std::unordered_map<size_t, std::string> item_names(names.begin(), names.end());
 
   //look for all the scans and print out what we were expecting
-  auto set = m_itemSets[i];
-  auto core = set->core();
+  auto core = error.set->core();
 
   for (auto item: core->items())
   {
@@ -579,42 +737,28 @@ Parser::parse_error(size_t i)
 
       if (token <= 127 && token >= ' ')
       {
-        std::cout << "'" << escape_character(static_cast<char>(token)) << "'";
+        out << "'" << escape_character(static_cast<char>(token)) << "'";
       }
       else
       {
-        std::cout << token;
+        out << token;
       }
-      std::cout << ", ";
+      out << ", ";
     }
 
-    item->print(std::cout, item_names);
-    std::cout << std::endl;
+    item->print(out, item_names);
+    out << std::endl;
   }
 
-  std::cout << "END" << std::endl;
+  out << "END" << std::endl;
 }
 
 void
 Parser::reset_set()
 {
-  //m_set_reset = true;
-  m_setOwner.pop_back();
-}
-
-ItemSetCore&
-Parser::next_core()
-{
-  if (m_core_reset)
-  {
-    m_coreOwner.back().reset();
-    m_core_reset = false;
-    return m_coreOwner.back();
-  }
-
-  auto& core = m_coreOwner.emplace_back();
-  core.number(m_coreOwner.size() - 1);
-  return core;
+  // The set at the back is a duplicate, so the next set can reuse it
+  // rather than freeing it now.
+  m_set_reset = true;
 }
 
 ItemSet&
@@ -627,148 +771,35 @@ Parser::next_set(ItemSetCore* core)
     return m_setOwner.back();
   }
 
-  return m_setOwner.emplace_back(core);
+  return m_setOwner.emplace_back(core, m_arenas);
 }
 
 void
 Parser::print_stats() const
 {
-  std::cout << "Hash set cores: " << m_set_core_hash.size() << std::endl;
-  std::cout << "Unique cores: " << m_coreOwner.size() << std::endl;
-  std::cout << "Goto collisions: " << m_lookahead_collisions << std::endl;
-  std::cout << "Goto successes: " << m_reuse << std::endl;
+  std::cout << "Cached cores: " << m_grammar.cores().size() << std::endl;
+  std::cout << "Goto hits: " << m_goto_stats.hits << std::endl;
+  std::cout << "Goto misses: " << m_goto_stats.misses << std::endl;
+  std::cout << "Goto evictions: " << m_goto_stats.evictions << std::endl;
+  std::cout << "Goto keys grown: " << m_goto_stats.grown << std::endl;
   std::cout << "Unique sets: " << m_setOwner.size() << std::endl;
   std::cout << "Unique distances: " << m_distance_hash.size() << std::endl;
+
+#ifdef EARLEY_HASH_STATS
+  print_table_stats("Item set table", m_item_set_hash);
+  print_table_stats("Goto table", m_set_term_lookahead);
+  print_table_stats("Distance table", m_distance_hash);
+#endif
 }
 
 void
 Parser::create_reductions()
 {
-  HashSet<ItemSet*> items_seen;
-  size_t reductions = 0;
-  size_t skipped_sets = 0;
-  size_t skipped_items = 0;
-
-  // This is almost the same algorithm as doing the completions of the initial
-  // items.
-  // We need to go from 1 to the end, because the first set won't have
-  // completed anything.
-
-  // The main difference is that we are counting the index in the item sets
-  // not the token position, so there is a +1 that doesn't appear here.
-
-  for (size_t position = 1; position < m_itemSets.size(); ++position)
-  {
-    auto item_set = m_itemSets[position];
-    if (!items_seen.insert(item_set).second)
-    {
-      ++skipped_sets;
-      continue;
-    }
-
-    auto core = item_set->core();
-    auto all_items = core->all_items();
-
-#ifdef DEBUG_REDUCTION
-    std::cout << core->number() << ": " << all_items << " ";
-#endif
-    for (size_t i = 0; i != all_items; ++i)
-    {
-      auto item = core->item(i);
-#ifdef DEBUG_REDUCTION
-      std::cout << item << " ";
-#endif
-
-      if (item == nullptr)
-      {
-        std::cout << "Fail at " << position << ":" << i << std::endl;
-        throw "fail";
-      }
-
-      // We only want actual end items.
-      if (item->position() == item->end())
-      {
-        auto distance = item_set->actual_distance(i);
-        auto from = position - distance; // no +1 because we're counting sets
-        auto from_set = m_itemSets.at(from);
-        auto from_core = from_set->core();
-
-        // find the symbol for the lhs of this rule in set that predicted this
-        // i.e., this is a completion: find the items it completes
-        auto transitions = m_set_symbols.find(SetSymbolRules(
-          from_core,
-          {item->rule().nonterminal(), false}
-        ));
-
-        if (transitions == m_set_symbols.end())
-        {
-          // This should never happen, because we will only ever get here
-          // if there is a successful parse.
-          if (item->rule().nonterminal() != m_grammar_new.start())
-          {
-            auto names = m_grammar_new.names();
-            std::unordered_map<size_t, std::string> item_names(
-              names.begin(), names.end());
-
-            for (auto& name: names)
-            {
-              std::cout << name.first << ", " << name.second << std::endl;
-            }
-
-            std::cerr << "Unexpected error finding transition " <<
-              print_nt(item_names, item->rule().nonterminal())
-              << " in set " << from
-                      << " at position "
-                      << position
-                      << std::endl;
-            throw "Error";
-          }
-          continue;
-        }
+  m_forest.build(*this, m_itemSets.size() - 1);
 
-        for (auto transition: transitions->second)
-        {
-          auto* titem = from_core->item(transition);
-          auto* next = get_item(&titem->rule(),
-            titem->dot() - titem->rule().begin() + 1);
-
-          // In the other algorithm we check lookahead. Here we check whether
-          // we already have this item in our set, because otherwise we don't
-          // care about it.
-          if (!in_item_set(next, item_set))
-          {
-            ++skipped_items;
-            continue;
-          }
-
-          auto transition_distance = from_set->actual_distance(transition) + distance;
-
-          auto pointers = m_item_tree.insert({next, item_set,
-            transition_distance});
-          insert_unique(pointers.first->reduction, {item, distance});
-
-          // Only add a predecessor if the transition item isn't at the
-          // start. When building the tree we would have processed the last
-          // reduction, so we don't actually care what the predecessor is.
-          if (titem->dot() != titem->rule().begin())
-          {
-            insert_unique(pointers.first->predecessor, {titem, distance});
-          }
-          ++reductions;
-        }
-      }
-#ifdef DEBUG_REDUCTION
-      std::cout << std::endl;
-#endif
-    }
-  }
-  std::cout << "Added " << reductions << " reductions" << std::endl;
-  std::cout << "Skipped " << skipped_sets << " sets" << std::endl;
-  std::cout << "Skipped " << skipped_items << " items" << std::endl;
+  std::cout << "Added " << m_forest.nodes() << " nodes" << std::endl;
+  std::cout << "Added " << m_forest.packed_nodes() << " packed nodes" <<
+    std::endl;
 }
 
-Stack<const Item*> ItemSetCore::item_stack;
-Stack<int> ItemSetCore::parent_stack;
-Stack<int> ItemSet::distance_stack;
-
 }
@@ -0,0 +1,277 @@
+#include "earley/fast.hpp"
+
+#include <algorithm>
+
+namespace earley::fast
+{
+
+Forest::Forest(std::pmr::memory_resource* resource)
+: m_resource(resource)
+, m_nodes(resource)
+, m_node_ids(1000, resource)
+, m_offsets(resource)
+, m_packed(resource)
+{
+}
+
+void
+Forest::build(const Parser& parser, size_t end)
+{
+  clear();
+
+  LazyForest reductions(parser, m_resource);
+  auto start = parser.grammar().start();
+  auto set = parser.set(end);
+
+  for (auto i: reductions.completed(set->core(), start))
+  {
+    if (set->actual_distance(i) == end)
+    {
+      m_root = add_node(nullptr, {start, false}, 0, end);
+      break;
+    }
+  }
+
+  // Each node is expanded after the ones before it, so its packed nodes
+  // follow theirs. Expanding a node can add more nodes.
+  for (Node node = 0; node != m_nodes.size(); ++node)
+  {
+    m_offsets.push_back(m_packed.size());
+    auto key = m_nodes[node];
+
+    if (key.item != nullptr)
+    {
+      add_derivations(reductions, key.item, key.start, key.end);
+    }
+    else if (!key.symbol.terminal)
+    {
+      auto set = parser.set(key.end);
+      auto core = set->core();
+      for (auto i: reductions.completed(core, key.symbol.index))
+      {
+        if (set->actual_distance(i) == key.end - key.start)
+        {
+          add_derivations(reductions, core->item(i), key.start, key.end);
+        }
+      }
+    }
+  }
+  m_offsets.push_back(m_packed.size());
+}
+
+Forest::Node
+Forest::add_node(const Item* item, grammar::Symbol symbol, size_t start,
+  size_t end)
+{
+  NodeKey key{item, symbol, static_cast<uint32_t>(start),
+    static_cast<uint32_t>(end)};
+  auto [iter, inserted] = m_node_ids.insert(
+    {key, static_cast<Node>(m_nodes.size())});
+
+  if (inserted)
+  {
+    m_nodes.push_back(key);
+  }
+
+  return iter->second;
+}
+
+Forest::Node
+Forest::prefix(const Item* item, size_t start, size_t end)
+{
+  switch (item->dot_index())
+  {
+    case 0:
+    return no_node;
+
+    case 1:
+    return add_node(nullptr, *item->rule().begin(), start, end);
+
+    default:
+    return add_node(item, {item->nonterminal(), false}, start, end);
+  }
+}
+
+void
+Forest::add_derivations(LazyForest& reductions, const Item* item,
+  size_t start, size_t end)
+{
+  // The same derivation can be found from more than one item that
+  // completes the last symbol.
+  auto add = [this](const Packed& packed) {
+    auto first = m_packed.begin() + m_offsets.back();
+    auto same = std::find_if(first, m_packed.end(),
+      [&](const Packed& p) {
+        return p.item == packed.item && p.left == packed.left &&
+          p.right == packed.right;
+      });
+
+    if (same == m_packed.end())
+    {
+      m_packed.push_back(packed);
+    }
+  };
+
+  if (item->dot() == item->rule().begin())
+  {
+    add({item, no_node, no_node});
+    return;
+  }
+
+  auto symbol = *(item->dot() - 1);
+  auto previous = item->previous();
+
+  if (symbol.terminal)
+  {
+    auto right = add_node(nullptr, symbol, end - 1, end);
+    add({item, prefix(previous, start, end - 1), right});
+    return;
+  }
+
+  for (auto& reduction: reductions.reductions(item, end, end - start))
+  {
+    auto middle = end - reduction.distance;
+    auto right = add_node(nullptr, symbol, middle, end);
+    add({item, prefix(previous, start, middle), right});
+  }
+}
+
+void
+Forest::clear()
+{
+  m_nodes.clear();
+  m_node_ids.clear();
+  m_offsets.clear();
+  m_packed.clear();
+  m_root = no_node;
+}
+
+std::optional<Forest::Node>
+Forest::find(grammar::Symbol symbol, size_t start, size_t end) const
+{
+  auto iter = m_node_ids.find(NodeKey{nullptr, symbol,
+    static_cast<uint32_t>(start), static_cast<uint32_t>(end)});
+  if (iter == m_node_ids.end())
+  {
+    return std::nullopt;
+  }
+
+  return iter->second;
+}
+
+std::optional<Forest::Node>
+Forest::find(const Item* item, size_t start, size_t end) const
+{
+  auto iter = m_node_ids.find(NodeKey{item, {item->nonterminal(), false},
+    static_cast<uint32_t>(start), static_cast<uint32_t>(end)});
+  if (iter == m_node_ids.end())
+  {
+    return std::nullopt;
+  }
+
+  return iter->second;
+}
+
+LazyForest::LazyForest(const Parser& parser,
+  std::pmr::memory_resource* resource)
+: m_parser(parser)
+, m_grammar(parser.grammar())
+, m_nodes(1000, resource)
+, m_reductions(resource)
+, m_completed(1000, resource)
+, m_completed_items(resource)
+{
+}
+
+LazyForest::Reductions
+LazyForest::reductions(const Item* item, size_t position, int distance)
+{
+  auto [iter, inserted] = m_nodes.insert({NodeKey{item, position, distance},
+    Reductions(nullptr, nullptr)});
+
+  if (inserted)
+  {
+    auto begin = m_reductions.start();
+    auto& rule = item->rule();
+
+    if (item->dot() != rule.begin() && !(item->dot() - 1)->terminal)
+    {
+      auto previous = item->previous();
+      auto set = m_parser.set(position);
+
+      for (auto i: completed(set->core(), (item->dot() - 1)->index))
+      {
+        int reduced = set->actual_distance(i);
+        if (reduced <= distance &&
+          in_set(previous, position - reduced, distance - reduced))
+        {
+          begin = m_reductions.emplace_back(
+            Reduction{set->core()->item(i), reduced});
+        }
+      }
+    }
+
+    auto end = begin + m_reductions.top_size();
+    m_reductions.finalise();
+    iter->second = Reductions(begin, end);
+  }
+
+  return iter->second;
+}
+
+Range<const uint16_t*>
+LazyForest::completed(const ItemSetCore* core, int nonterminal)
+{
+  auto [iter, inserted] = m_completed.insert({SetSymbolRules(
+    const_cast<ItemSetCore*>(core), {nonterminal, false}),
+    Range<const uint16_t*>(nullptr, nullptr)});
+
+  if (inserted)
+  {
+    auto begin = m_completed_items.start();
+    for (size_t i = 0; i != core->all_items(); ++i)
+    {
+      auto item = core->item(i);
+      if (item->nonterminal() == nonterminal && item->complete())
+      {
+        begin = m_completed_items.emplace_back(i);
+      }
+    }
+
+    auto end = begin + m_completed_items.top_size();
+    m_completed_items.finalise();
+    iter->second = Range<const uint16_t*>(begin, end);
+  }
+
+  return iter->second;
+}
+
+bool
+LazyForest::in_set(const Item* item, size_t position, int distance)
+{
+  // The item that starts a rule is predicted where it starts.
+  if (item->dot() == item->rule().begin())
+  {
+    return distance == 0;
+  }
+
+  // The items with the nonterminal after the dot are already indexed for
+  // the completions.
+  auto set = m_parser.set(position);
+  auto core = set->core();
+  auto transitions = m_grammar.cores().transitions(core,
+    *item->dot());
+
+  for (auto i: transitions)
+  {
+    if (core->item(i) == item &&
+      set->actual_distance(i) == static_cast<size_t>(distance))
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+}
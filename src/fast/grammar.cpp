@@ -1,5 +1,7 @@
+#include <algorithm>
 #include <cassert>
 #include "earley/fast/grammar.hpp"
+#include "earley/fast/tables.hpp"
 
 namespace earley::fast::grammar
 {
@@ -42,6 +44,38 @@ Grammar::Grammar(
   m_follow_sets = grammar::follow_sets(start_index, m_nonterminal_rules, m_first_sets);
 }
 
+Grammar::Grammar(const GrammarTables& tables)
+: m_start(tables.start)
+, m_nullable(tables.nullable, tables.nullable + tables.nonterminals)
+{
+  m_nonterminal_rules.resize(tables.nonterminals);
+
+  for (size_t nonterminal = 0; nonterminal != tables.nonterminals;
+    ++nonterminal)
+  {
+    std::string name(tables.names[nonterminal]);
+    m_nonterminal_indices.index(name);
+    m_indices.insert({name, nonterminal});
+    m_names.insert({nonterminal, name});
+
+    auto& rules = m_nonterminal_rules[nonterminal];
+    for (auto rule = tables.rule_offsets[nonterminal];
+      rule != tables.rule_offsets[nonterminal + 1]; ++rule)
+    {
+      std::vector<Symbol> symbols(
+        tables.symbols + tables.symbol_offsets[rule],
+        tables.symbols + tables.symbol_offsets[rule + 1]);
+
+      ActionArgs actions{tables.actions[rule], {
+        tables.action_args + tables.action_offsets[rule],
+        tables.action_args + tables.action_offsets[rule + 1]}};
+
+      rules.push_back(Rule(nonterminal, std::move(symbols),
+        std::move(actions)));
+    }
+  }
+}
+
 void
 Grammar::insert_nonterminal(
   int index,
@@ -63,7 +97,7 @@ Grammar::insert_nonterminal(
 }
 
 const RuleList&
-Grammar::rules(const std::string& name)
+Grammar::rules(const std::string& name) const
 {
   auto iter = m_indices.find(name);
 
@@ -145,127 +179,365 @@ Grammar::build_nonterminal
       symbols.push_back(build_symbol(gsym));
     }
 
-    nonterminal.push_back(Rule(index, std::move(symbols)));
+    nonterminal.push_back(Rule(index, std::move(symbols), rule.arguments()));
   }
 
   return nonterminal;
 }
 
-std::unordered_map<size_t, std::unordered_set<int>>
-first_sets(const std::vector<RuleList>& rules)
+namespace
+{
+
+// Sets of terminals as rows of bits, a row for each nonterminal. The
+// terminals are given columns in the order that they are first seen.
+class TerminalRows
 {
-  std::unordered_map<size_t, std::unordered_set<int>> first_set;
+  public:
 
-  bool changed = true;
-  while (changed)
+  TerminalRows(size_t rows, const std::vector<RuleList>& rules)
+  : m_rows(rows)
   {
-    changed = false;
+    column(EPSILON);
+    column(END_OF_INPUT);
 
-    for (size_t i = 0; i != rules.size(); ++i)
+    for (auto& rule_list: rules)
     {
-      auto& rule_list = rules[i];
-      auto nt = i;
-      auto& set = first_set[nt];
-
       for (auto& rule: rule_list)
       {
-        if (rule.begin() == rule.end())
+        for (auto& symbol: rule)
         {
-          changed |= insert_value(-1, set);
-          continue;
+          if (symbol.terminal)
+          {
+            column(symbol.index);
+          }
+        }
+      }
+    }
+
+    m_words = (m_terminals.size() + 63) / 64;
+    m_bits.resize(m_rows * m_words);
+  }
+
+  size_t
+  column(int terminal)
+  {
+    auto [iter, inserted] = m_columns.insert({terminal, m_terminals.size()});
+    if (inserted)
+    {
+      m_terminals.push_back(terminal);
+    }
+
+    return iter->second;
+  }
+
+  uint64_t*
+  row(size_t i)
+  {
+    return m_bits.data() + i * m_words;
+  }
+
+  size_t
+  words() const
+  {
+    return m_words;
+  }
+
+  void
+  set(uint64_t* row, int terminal)
+  {
+    auto c = column(terminal);
+    row[c / 64] |= uint64_t(1) << (c % 64);
+  }
+
+  void
+  merge(uint64_t* to, const uint64_t* from) const
+  {
+    for (size_t i = 0; i != m_words; ++i)
+    {
+      to[i] |= from[i];
+    }
+  }
+
+  // Every row as a set of terminals.
+  std::unordered_map<size_t, std::unordered_set<int>>
+  sets()
+  {
+    std::unordered_map<size_t, std::unordered_set<int>> sets;
+    for (size_t i = 0; i != m_rows; ++i)
+    {
+      auto& set = sets[i];
+      auto bits = row(i);
+      for (size_t word = 0; word != m_words; ++word)
+      {
+        for (auto w = bits[word]; w != 0; w &= w - 1)
+        {
+          set.insert(m_terminals[word * 64 + __builtin_ctzll(w)]);
         }
+      }
+    }
+
+    return sets;
+  }
+
+  private:
+  size_t m_rows;
+  size_t m_words = 0;
+  std::unordered_map<int, size_t> m_columns;
+  std::vector<int> m_terminals;
+  std::vector<uint64_t> m_bits;
+};
+
+// Merges into each row the rows that it depends on, and everything that
+// they depend on in turn.
+//
+// The rows in a strongly connected component of the dependencies all end
+// up the same, so the components are found with Tarjan's algorithm, which
+// finishes a component only after everything that it depends on. Each
+// row is then merged once per dependency, rather than until nothing
+// changes.
+void
+close_rows(TerminalRows& rows,
+  const std::vector<std::vector<uint32_t>>& depends)
+{
+  const uint32_t unvisited = ~uint32_t(0);
+  auto nodes = depends.size();
+
+  std::vector<uint32_t> index(nodes, unvisited);
+  std::vector<uint32_t> low(nodes);
+  std::vector<uint32_t> component(nodes, unvisited);
+  std::vector<uint32_t> stack;
 
-        auto entry_iter = rule.begin();
-        while (entry_iter != rule.end())
+  // The nodes being visited, and the next dependency of each to look at.
+  std::vector<std::pair<uint32_t, size_t>> visiting;
+  uint32_t next_index = 0;
+  uint32_t components = 0;
+
+  std::vector<uint64_t> merged(rows.words());
+
+  for (uint32_t root = 0; root != nodes; ++root)
+  {
+    if (index[root] != unvisited)
+    {
+      continue;
+    }
+
+    visiting.push_back({root, 0});
+    index[root] = low[root] = next_index++;
+    stack.push_back(root);
+
+    while (!visiting.empty())
+    {
+      auto& [node, edge] = visiting.back();
+
+      if (edge != depends[node].size())
+      {
+        auto next = depends[node][edge++];
+        if (index[next] == unvisited)
         {
-          auto& entry = *entry_iter;
-          if (entry.terminal)
-          {
-            changed |= insert_value(entry.index, set);
-            break;
-          }
-          else
+          index[next] = low[next] = next_index++;
+          stack.push_back(next);
+          visiting.push_back({next, 0});
+        }
+        else if (component[next] == unvisited)
+        {
+          // Still on the stack, so it is in this component.
+          low[node] = std::min(low[node], index[next]);
+        }
+        continue;
+      }
+
+      auto finished = node;
+      visiting.pop_back();
+
+      if (!visiting.empty())
+      {
+        auto parent = visiting.back().first;
+        low[parent] = std::min(low[parent], low[finished]);
+      }
+
+      if (low[finished] != index[finished])
+      {
+        continue;
+      }
+
+      // `finished` is the root of a component, which is everything above
+      // it on the stack.
+      auto first = std::find(stack.rbegin(), stack.rend(), finished).base() - 1;
+      for (auto member = first; member != stack.end(); ++member)
+      {
+        component[*member] = components;
+      }
+
+      std::fill(merged.begin(), merged.end(), 0);
+      for (auto member = first; member != stack.end(); ++member)
+      {
+        rows.merge(merged.data(), rows.row(*member));
+        for (auto dependency: depends[*member])
+        {
+          if (component[dependency] != components)
           {
-            auto next = entry.index;
-            auto& next_first = first_set[next];
-
-            for (auto first: next_first)
-            {
-              // skip epsilon for this set
-              if (first == -1)
-              {
-                continue;
-              }
-              changed |= insert_value(first, set);
-            }
-
-            // bail if epsilon isn't in this item's first set
-            if (next_first.count(-1) == 0)
-            {
-              break;
-            }
+            rows.merge(merged.data(), rows.row(dependency));
           }
-          ++entry_iter;
         }
+      }
+
+      for (auto member = first; member != stack.end(); ++member)
+      {
+        std::copy(merged.begin(), merged.end(), rows.row(*member));
+      }
+
+      stack.erase(first, stack.end());
+      ++components;
+    }
+  }
+}
 
-        // add epsilon for this set if we got all the way to the end
-        if (entry_iter == rule.end())
+// The number of nonterminals, including any that are used but have no
+// rules.
+size_t
+count_nonterminals(const std::vector<RuleList>& rules)
+{
+  size_t count = rules.size();
+  for (auto& rule_list: rules)
+  {
+    for (auto& rule: rule_list)
+    {
+      for (auto& symbol: rule)
+      {
+        if (!symbol.terminal)
         {
-          changed |= insert_value(-1, set);
+          count = std::max(count, static_cast<size_t>(symbol.index) + 1);
         }
       }
     }
   }
 
-  return first_set;
+  return count;
 }
 
-FollowSets
-follow_sets(int start, const std::vector<RuleList>& rules, FirstSets& firsts)
+}
+
+FirstSets
+first_sets(const std::vector<RuleList>& rules)
 {
-  FollowSets follows;
+  auto nonterminals = count_nonterminals(rules);
+  auto nullable = find_nullable(rules);
+  nullable.resize(nonterminals);
+
+  TerminalRows firsts(nonterminals, rules);
+  std::vector<std::vector<uint32_t>> depends(nonterminals);
+
+  // The first set of a rule is the first terminal, or the first sets of
+  // the nonterminals up to the first one that isn't nullable.
+  for (size_t nt = 0; nt != rules.size(); ++nt)
+  {
+    for (auto& rule: rules[nt])
+    {
+      for (auto& symbol: rule)
+      {
+        if (symbol.terminal)
+        {
+          firsts.set(firsts.row(nt), symbol.index);
+          break;
+        }
+
+        depends[nt].push_back(symbol.index);
+        if (!nullable[symbol.index])
+        {
+          break;
+        }
+      }
+    }
+  }
 
-  follows[start].insert(END_OF_INPUT);
+  close_rows(firsts, depends);
 
-  bool changed = true;
-  while (changed)
+  for (size_t nt = 0; nt != nonterminals; ++nt)
   {
-    changed = false;
+    if (nullable[nt])
+    {
+      firsts.set(firsts.row(nt), EPSILON);
+    }
+  }
+
+  return firsts.sets();
+}
 
-    for (size_t i = 0; i != rules.size(); ++i)
+FollowSets
+follow_sets(int start, const std::vector<RuleList>& rules, FirstSets& first)
+{
+  auto nonterminals = count_nonterminals(rules);
+
+  // Made from the same rules, so a terminal has the same column in both.
+  TerminalRows firsts(nonterminals, rules);
+  TerminalRows follows(nonterminals, rules);
+  std::vector<bool> nullable(nonterminals);
+
+  for (auto& [nt, set]: first)
+  {
+    if (nt >= nonterminals)
     {
-      auto lhs = i;
-      auto& rule_list = rules[lhs];
+      continue;
+    }
 
-      for (auto& rule: rule_list)
+    for (auto terminal: set)
+    {
+      if (terminal == EPSILON)
       {
-        auto position = rule.begin();
-        while (position != rule.end())
-        {
-          if (!position->terminal)
-          {
-            auto nt = position->index;
-            auto first = first_set(position+1, rule.end(), firsts);
+        nullable[nt] = true;
+      }
+      else
+      {
+        firsts.set(firsts.row(nt), terminal);
+      }
+    }
+  }
 
-            if (first.count(EPSILON))
-            {
-              changed |= insert_range(follows[lhs].begin(),
-                follows[lhs].end(),
-                follows[nt]);
+  follows.set(follows.row(start), END_OF_INPUT);
 
-              first.erase(EPSILON);
-            }
+  // The follow set of a nonterminal has the first set of what comes after
+  // it, and if that can be empty, the follow set of the rule's nonterminal.
+  std::vector<std::vector<uint32_t>> depends(nonterminals);
+  std::vector<uint64_t> suffix(firsts.words());
 
-            changed |= insert_range(first.begin(), first.end(), follows[nt]);
-          }
+  for (size_t nt = 0; nt != rules.size(); ++nt)
+  {
+    for (auto& rule: rules[nt])
+    {
+      std::fill(suffix.begin(), suffix.end(), 0);
+      bool suffix_nullable = true;
+
+      for (auto symbol = rule.end(); symbol != rule.begin();)
+      {
+        --symbol;
 
-          ++position;
+        if (symbol->terminal)
+        {
+          std::fill(suffix.begin(), suffix.end(), 0);
+          firsts.set(suffix.data(), symbol->index);
+          suffix_nullable = false;
+          continue;
+        }
+
+        follows.merge(follows.row(symbol->index), suffix.data());
+        if (suffix_nullable)
+        {
+          depends[symbol->index].push_back(nt);
         }
+
+        if (!nullable[symbol->index])
+        {
+          std::fill(suffix.begin(), suffix.end(), 0);
+          suffix_nullable = false;
+        }
+        firsts.merge(suffix.data(), firsts.row(symbol->index));
       }
     }
   }
 
-  return follows;
+  close_rows(follows, depends);
+
+  return follows.sets();
 }
 
 HashSet<int>
@@ -1,4 +1,7 @@
 #include "earley/fast/items.hpp"
+#include "earley/fast/tables.hpp"
+
+#include <algorithm>
 
 namespace earley::fast
 {
@@ -30,100 +33,160 @@ empty_sequence(const std::vector<bool>& nullable,
   return true;
 }
 
-struct RuleItemComparator
+void
+set_bit(uint64_t* row, size_t bit)
 {
+  row[bit / 64] |= uint64_t(1) << (bit % 64);
+}
+
+// Works out the items from the first and follow sets.
+struct SetsSource
+{
+  const grammar::FirstSets& firsts;
+  const grammar::FollowSets& follows;
+  const std::vector<bool>& nullable;
+
   bool
-  operator()(
-    const grammar::Rule* r,
-    const std::pair<const grammar::Rule*, ItemStore>& p
-  )
+  empty_rhs(const grammar::Rule& rule, grammar::Rule::iterator position,
+    size_t)
   {
-    return r < p.first;
+    return empty_sequence(nullable, position, rule.end());
   }
 
-  bool
-  operator()(
-    const std::pair<const grammar::Rule*, ItemStore>& p,
-    const grammar::Rule* r
-  )
+  // Every item can come before END_OF_INPUT, and none before a terminal
+  // that isn't in the grammar. The rest is filled in by lookahead.
+  const uint64_t*
+  admissible(std::vector<uint64_t>& built, size_t terminals,
+    size_t row_words)
   {
-    return p.first < r;
+    built.resize((terminals + 2) * row_words);
+    std::fill_n(built.begin() + terminals * row_words, row_words,
+      ~uint64_t(0));
+    return built.data();
   }
-};
 
-}
+  void
+  lookahead(const grammar::Rule& rule, grammar::Rule::iterator position,
+    size_t index, std::vector<uint64_t>& built, size_t row_words)
+  {
+    for (auto symbol: sequence_lookahead(rule, position, firsts, follows))
+    {
+      set_bit(built.data() + symbol * row_words, index);
+    }
+  }
+};
 
-// TODO: move this to utils and test it
-template <typename T>
-void
-ensure_size(T& t, size_t size)
+// Reads the items from tables.
+struct TablesSource
 {
-  if (size >= t.size())
+  const GrammarTables& tables;
+
+  bool
+  empty_rhs(const grammar::Rule&, grammar::Rule::iterator, size_t index)
   {
-    t.resize(size+1);
+    return tables.empty_rhs[index];
   }
-}
 
-void
-Items::fill_to(const grammar::Rule* rule, ItemStore& items, size_t position)
-{
-  items.reserve(position);
-  for (size_t i = items.size(); i <= position; ++i)
+  // The bitmap is used where it is.
+  const uint64_t*
+  admissible(std::vector<uint64_t>&, size_t, size_t)
   {
-    auto lookahead = sequence_lookahead(*rule, rule->begin() + i,
-      m_firsts, m_follows);
-
-    items.emplace_back(
-      rule,
-      rule->begin()+i,
-      std::move(lookahead),
-      empty_sequence(m_nullable,
-        rule->begin()+i,
-        rule->end()
-      ),
-      m_item_index
-    );
-    ++m_item_index;
+    return tables.admissible;
   }
-}
 
-Items::Items(const std::vector<grammar::RuleList>& nonterminals,
-  const grammar::FirstSets& firsts,
-  const grammar::FollowSets& follows,
-  const std::vector<bool>& nullable)
-: m_firsts(firsts)
-, m_follows(follows)
-, m_nullable(nullable)
+  void
+  lookahead(const grammar::Rule&, grammar::Rule::iterator, size_t,
+    std::vector<uint64_t>&, size_t)
+  {
+  }
+};
+
+// One more than the largest terminal in the rules.
+size_t
+count_terminals(const std::vector<grammar::RuleList>& nonterminals)
 {
+  size_t terminals = 0;
   for (auto& rules: nonterminals)
   {
     for (auto& rule: rules)
     {
-      auto& position = insert_rule(&rule);
-      fill_to(&rule, position, rule.end() - rule.begin());
+      for (auto& symbol: rule)
+      {
+        if (symbol.terminal && static_cast<size_t>(symbol.index) >= terminals)
+        {
+          terminals = symbol.index + 1;
+        }
+      }
     }
   }
+
+  return terminals;
+}
+
 }
 
-ItemStore&
-Items::insert_rule(const grammar::Rule* rule)
+Items::Items(const std::vector<grammar::RuleList>& nonterminals,
+  const grammar::FirstSets& firsts,
+  const grammar::FollowSets& follows,
+  const std::vector<bool>& nullable)
 {
-  if (m_rule_array.size() <= rule->index())
-  {
-    m_rule_array.resize(rule->index()+1);
-  }
-  return m_rule_array[rule->index()];
+  build(nonterminals, count_terminals(nonterminals),
+    SetsSource{firsts, follows, nullable});
 }
 
-const ItemStore*
-Items::find_rule(const grammar::Rule* rule)
+Items::Items(const std::vector<grammar::RuleList>& nonterminals,
+  const GrammarTables& tables)
+{
+  build(nonterminals, tables.terminals, TablesSource{tables});
+}
+
+template <typename Source>
+void
+Items::build(const std::vector<grammar::RuleList>& nonterminals,
+  size_t terminals, Source source)
 {
-  if (m_rule_array.size() <= rule->index())
+  size_t count = 0;
+  size_t rules = 0;
+  for (auto& rule_list: nonterminals)
   {
-    return nullptr;
+    for (auto& rule: rule_list)
+    {
+      count += rule.end() - rule.begin() + 1;
+      rules = std::max(rules, rule.index() + 1);
+    }
   }
 
-  return &m_rule_array[rule->index()];
+  // Reserved so that the items never move.
+  m_items.reserve(count);
+  m_rule_items.resize(rules, no_items);
+  m_terminals = terminals;
+  m_row_words = (count + 63) / 64;
+  m_admissible = source.admissible(m_built, m_terminals, m_row_words);
+
+  for (auto& rule_list: nonterminals)
+  {
+    for (auto& rule: rule_list)
+    {
+      m_rule_items[rule.index()] = m_items.size();
+
+      for (auto position = rule.begin(); ; ++position)
+      {
+        auto index = m_items.size();
+        auto& item = m_items.emplace_back(&rule, position,
+          source.empty_rhs(rule, position, index), index);
+
+        source.lookahead(rule, position, index, m_built, m_row_words);
+        item.m_lookahead = m_admissible + index / 64;
+        item.m_row_words = m_row_words;
+        item.m_terminals = m_terminals;
+
+        if (position == rule.end())
+        {
+          break;
+        }
+      }
+    }
+  }
 }
 
 std::ostream&
@@ -164,14 +227,12 @@ Item::print(
   }
 
   os << ": ( ";
-  size_t i = 0;
-  for (auto symbol: m_lookahead)
+  for (size_t symbol = 0; symbol != m_terminals; ++symbol)
   {
-    if (symbol)
+    if (in_lookahead(symbol))
     {
-      os << i << " ";
+      os << symbol << " ";
     }
-    ++i;
   }
   os << ")";
 
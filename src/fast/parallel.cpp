@@ -0,0 +1,308 @@
+#include "earley/fast/parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+
+namespace earley::fast
+{
+
+std::vector<size_t>
+cut_points(const TerminalList& tokens, const CutTerminals& terminals)
+{
+  std::vector<size_t> cuts;
+  std::vector<int> depths(terminals.brackets.size(), 0);
+  int nesting = 0;
+
+  auto is_end = [&] (size_t token) {
+    return std::find(terminals.ends.begin(), terminals.ends.end(), token)
+      != terminals.ends.end();
+  };
+
+  for (size_t position = 0; position != tokens.size(); ++position)
+  {
+    auto token = tokens[position];
+    for (size_t i = 0; i != terminals.brackets.size(); ++i)
+    {
+      if (token == terminals.brackets[i].first)
+      {
+        ++depths[i];
+        ++nesting;
+      }
+      else if (token == terminals.brackets[i].second && depths[i] > 0)
+      {
+        --depths[i];
+        --nesting;
+      }
+    }
+
+    if (nesting == 0 && is_end(token))
+    {
+      // An end that is followed by another, such as the '}' of `};`, is
+      // only cut after the last one.
+      if (!cuts.empty() && cuts.back() == position)
+      {
+        cuts.back() = position + 1;
+      }
+      else
+      {
+        cuts.push_back(position + 1);
+      }
+    }
+  }
+
+  return cuts;
+}
+
+grammar::Symbol
+list_element(const CompiledGrammar& grammar)
+{
+  auto nonterminal = grammar.start();
+
+  // Follow the rules that are a single nonterminal, such as the start
+  // rule. A cycle of them is stopped by the limit.
+  for (size_t i = 0; i != grammar.grammar().all_rules().size(); ++i)
+  {
+    auto& rules = grammar.rules(nonterminal);
+    if (rules.size() != 1 || rules.front().end() - rules.front().begin() != 1
+      || rules.front().begin()->terminal)
+    {
+      break;
+    }
+
+    nonterminal = rules.front().begin()->index;
+  }
+
+  grammar::Symbol self{nonterminal, false};
+  std::optional<grammar::Symbol> element;
+  bool recursive = false;
+
+  for (auto& rule: grammar.rules(nonterminal))
+  {
+    std::vector<grammar::Symbol> symbols(rule.begin(), rule.end());
+    grammar::Symbol found{};
+
+    if (symbols.empty())
+    {
+      continue;
+    }
+    else if (symbols.size() == 1 && !(symbols[0] == self))
+    {
+      found = symbols[0];
+    }
+    else if (symbols.size() == 2 && symbols[0] == self &&
+      !(symbols[1] == self))
+    {
+      found = symbols[1];
+      recursive = true;
+    }
+    else if (symbols.size() == 2 && symbols[1] == self &&
+      !(symbols[0] == self))
+    {
+      found = symbols[0];
+      recursive = true;
+    }
+    else
+    {
+      throw NotAList();
+    }
+
+    if (element && !(*element == found))
+    {
+      throw NotAList();
+    }
+    element = found;
+  }
+
+  // Without a rule that repeats it, the start symbol is at most one X, and
+  // two sentences next to each other aren't a sentence.
+  if (!element || !recursive)
+  {
+    throw NotAList();
+  }
+
+  return *element;
+}
+
+ParallelParser::ParallelParser(const CompiledGrammar& grammar,
+  size_t threads)
+: m_grammar(grammar)
+, m_threads(std::max<size_t>(threads, 1))
+{
+  list_element(m_grammar);
+}
+
+std::optional<ParseError>
+ParallelParser::recognise(const TerminalList& tokens,
+  const std::vector<size_t>& cuts)
+{
+  m_chunks.clear();
+  m_stats = Stats();
+
+  // A few chunks for each thread, so that a slow chunk doesn't leave the
+  // other threads waiting.
+  auto length = tokens.size() / (m_threads * 4) + 1;
+  size_t begin = 0;
+  for (auto cut: cuts)
+  {
+    if (cut >= begin + length && cut < tokens.size())
+    {
+      m_chunks.push_back(Chunk{begin, cut});
+      begin = cut;
+    }
+  }
+  m_chunks.push_back(Chunk{begin, tokens.size()});
+  m_stats.chunks = m_chunks.size();
+
+  while (true)
+  {
+    parse_chunks(tokens);
+    ++m_stats.rounds;
+
+    // The first chunk was parsed with the real lookaheads until its last
+    // token.
+    auto& first = m_chunks.front();
+    if (first.error &&
+      (m_chunks.size() == 1 || first.error->position + 1 < first.end))
+    {
+      return first.error;
+    }
+
+    bool failed = false;
+    for (auto& chunk: m_chunks)
+    {
+      failed = failed || chunk.error;
+    }
+
+    if (!failed)
+    {
+      return std::nullopt;
+    }
+
+    join_chunks();
+  }
+}
+
+void
+ParallelParser::parse_chunks(const TerminalList& tokens)
+{
+  std::atomic<size_t> next = 0;
+  std::exception_ptr thrown;
+  std::atomic_flag throwing = ATOMIC_FLAG_INIT;
+
+  auto work = [&] {
+    try
+    {
+      for (auto i = next++; i < m_chunks.size(); i = next++)
+      {
+        auto& chunk = m_chunks[i];
+        if (chunk.parser)
+        {
+          continue;
+        }
+
+        chunk.tokens = std::make_unique<TerminalList>(
+          tokens.begin() + chunk.begin, tokens.begin() + chunk.end);
+        chunk.parser = std::make_unique<Parser>(m_grammar, *chunk.tokens);
+        chunk.error = chunk.parser->recognise();
+
+        if (chunk.error)
+        {
+          chunk.error->position += chunk.begin;
+        }
+      }
+    }
+    catch (...)
+    {
+      if (!throwing.test_and_set())
+      {
+        thrown = std::current_exception();
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < m_threads; ++i)
+  {
+    threads.emplace_back(work);
+  }
+  work();
+
+  for (auto& thread: threads)
+  {
+    thread.join();
+  }
+
+  if (thrown)
+  {
+    std::rethrow_exception(thrown);
+  }
+}
+
+void
+ParallelParser::join_chunks()
+{
+  std::vector<Chunk> joined;
+
+  for (size_t i = 0; i != m_chunks.size(); ++i)
+  {
+    auto& chunk = m_chunks[i];
+    if (!chunk.error)
+    {
+      joined.push_back(std::move(chunk));
+    }
+    else if (chunk.error->position + 1 >= chunk.end)
+    {
+      // It failed at its end, so it was cut too early.
+      if (i + 1 != m_chunks.size())
+      {
+        joined.push_back(join(chunk, m_chunks[i + 1]));
+        ++i;
+      }
+      else
+      {
+        auto previous = std::move(joined.back());
+        joined.back() = join(previous, chunk);
+      }
+    }
+    else
+    {
+      // It failed before its end, so it was started at the wrong place.
+      auto position = chunk.error->position;
+      if (chunk.failed_at == position)
+      {
+        // Joining it to the chunk before didn't help.
+        for (size_t j = 1; j != joined.size(); ++j)
+        {
+          joined.front() = join(joined.front(), joined[j]);
+        }
+        joined.erase(joined.begin() + 1, joined.end());
+        joined.front() = join(joined.front(), chunk);
+      }
+      else
+      {
+        joined.back() = join(joined.back(), chunk);
+        joined.back().failed_at = position;
+      }
+    }
+  }
+
+  m_chunks = std::move(joined);
+}
+
+ParallelParser::Chunk
+ParallelParser::join(Chunk& first, Chunk& second)
+{
+  for (auto chunk: {&first, &second})
+  {
+    if (chunk->parser)
+    {
+      m_stats.reparsed += chunk->end - chunk->begin;
+    }
+  }
+
+  return Chunk{first.begin, second.end};
+}
+
+}
@@ -0,0 +1,418 @@
+#include "earley/fast/tables.hpp"
+#include "earley/fast/compiled.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+
+namespace earley::fast
+{
+
+BuiltTables::BuiltTables(const CompiledGrammar& compiled)
+{
+  auto& grammar = compiled.grammar();
+  auto& all_rules = grammar.all_rules();
+  auto nonterminals = all_rules.size();
+
+  m_nullable = std::make_unique<bool[]>(nonterminals);
+  m_empty_rhs = std::make_unique<bool[]>(compiled.items());
+
+  m_rule_offsets.push_back(0);
+  m_symbol_offsets.push_back(0);
+  m_action_offsets.push_back(0);
+
+  size_t items = 0;
+  for (size_t nonterminal = 0; nonterminal != nonterminals; ++nonterminal)
+  {
+    m_name_strings.push_back(grammar.names().find(nonterminal)->second);
+    m_nullable[nonterminal] = grammar.nullable(nonterminal);
+
+    for (auto& rule: all_rules[nonterminal])
+    {
+      m_symbols.insert(m_symbols.end(), rule.begin(), rule.end());
+      m_symbol_offsets.push_back(m_symbols.size());
+
+      auto& [action, arguments] = rule.actions();
+      m_action_strings.push_back(action);
+      m_action_args.insert(m_action_args.end(), arguments.begin(),
+        arguments.end());
+      m_action_offsets.push_back(m_action_args.size());
+
+      size_t length = rule.end() - rule.begin();
+      for (size_t dot = 0; dot <= length; ++dot)
+      {
+        auto item = compiled.get_item(&rule, dot);
+
+        // The tables are loaded by numbering the items in this order.
+        assert(item->index() == items);
+        m_empty_rhs[items] = item->empty_rhs();
+        ++items;
+      }
+    }
+
+    m_rule_offsets.push_back(m_symbol_offsets.size() - 1);
+  }
+
+  // Only take the pointers once the strings have stopped moving.
+  for (auto& name: m_name_strings)
+  {
+    m_names.push_back(name.c_str());
+  }
+
+  for (auto& action: m_action_strings)
+  {
+    m_actions.push_back(action.c_str());
+  }
+
+  auto row_words = (compiled.items() + 63) / 64;
+  auto terminals = compiled.terminals();
+
+  // The last two rows are END_OF_INPUT and everything else.
+  for (size_t row = 0; row != terminals + 2; ++row)
+  {
+    int terminal = row == terminals ? int(grammar::END_OF_INPUT) : row;
+    auto bits = compiled.admissible(terminal);
+    m_admissible.insert(m_admissible.end(), bits, bits + row_words);
+  }
+
+  m_prediction_offsets.push_back(0);
+  for (size_t nonterminal = 0; nonterminal != nonterminals; ++nonterminal)
+  {
+    for (auto item: compiled.predictions(nonterminal))
+    {
+      m_predictions.push_back(item->index());
+    }
+    m_prediction_offsets.push_back(m_predictions.size());
+  }
+
+  m_tables = GrammarTables{
+    nonterminals,
+    grammar.start(),
+    m_names.data(),
+    m_nullable.get(),
+    m_rule_offsets.data(),
+    m_symbol_offsets.data(),
+    m_symbols.data(),
+    m_actions.data(),
+    m_action_offsets.data(),
+    m_action_args.data(),
+    compiled.items(),
+    terminals,
+    row_words,
+    m_admissible.data(),
+    m_empty_rhs.get(),
+    m_prediction_offsets.data(),
+    m_predictions.data(),
+  };
+}
+
+namespace
+{
+
+const char tables_magic[8] = {'E', 'A', 'R', 'L', 'E', 'Y', 'G', 'T'};
+
+// Incremented whenever the layout changes.
+const uint32_t tables_version = 1;
+
+// Reads back as something else in the other byte order.
+const uint32_t tables_byte_order = 0x01020304;
+
+struct TablesHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+
+  uint64_t nonterminals;
+  int64_t start;
+  uint64_t rules;
+  uint64_t symbols;
+  uint64_t action_args;
+  uint64_t items;
+  uint64_t terminals;
+  uint64_t row_words;
+  uint64_t predictions;
+  uint64_t strings;
+};
+
+// The symbols are used in place, so their layout is part of the format.
+static_assert(sizeof(grammar::Symbol) == 8);
+static_assert(offsetof(grammar::Symbol, index) == 0);
+static_assert(offsetof(grammar::Symbol, terminal) == 4);
+static_assert(sizeof(bool) == 1);
+
+size_t
+aligned(size_t size)
+{
+  return (size + 7) & ~size_t(7);
+}
+
+template <typename T>
+void
+write_array(std::ostream& os, const T* values, size_t size)
+{
+  auto bytes = size * sizeof(T);
+  os.write(reinterpret_cast<const char*>(values), bytes);
+
+  const char padding[8] = {};
+  os.write(padding, aligned(bytes) - bytes);
+}
+
+// Takes the arrays out of the data in the order that they were written,
+// checking that each one fits.
+class TablesReader
+{
+  public:
+
+  TablesReader(const char* data, size_t size)
+  : m_data(data)
+  , m_size(size)
+  {
+  }
+
+  template <typename T>
+  const T*
+  array(size_t size)
+  {
+    auto bytes = size * sizeof(T);
+    if (size > m_size / sizeof(T) || aligned(bytes) > m_size - m_used)
+    {
+      throw BadTables();
+    }
+
+    auto values = reinterpret_cast<const T*>(m_data + m_used);
+    m_used += aligned(bytes);
+    return values;
+  }
+
+  private:
+  const char* m_data;
+  size_t m_size;
+  size_t m_used = 0;
+};
+
+// Whether `offsets` has an entry for each of `size` things and one more,
+// going up from zero to `end`.
+bool
+valid_offsets(const uint32_t* offsets, size_t size, uint64_t end)
+{
+  if (offsets[0] != 0 || offsets[size] != end)
+  {
+    return false;
+  }
+
+  for (size_t i = 0; i != size; ++i)
+  {
+    if (offsets[i] > offsets[i + 1])
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool
+valid_bools(const bool* values, size_t size)
+{
+  auto bytes = reinterpret_cast<const unsigned char*>(values);
+  return std::all_of(bytes, bytes + size,
+    [](unsigned char byte) { return byte <= 1; });
+}
+
+}
+
+void
+write_tables(std::ostream& os, const GrammarTables& tables)
+{
+  auto rules = tables.rule_offsets[tables.nonterminals];
+
+  // The offsets of the names and actions in the strings.
+  std::string strings;
+  std::vector<uint32_t> names, actions;
+  for (size_t i = 0; i != tables.nonterminals; ++i)
+  {
+    names.push_back(strings.size());
+    strings.append(tables.names[i]).push_back('\0');
+  }
+  for (size_t i = 0; i != rules; ++i)
+  {
+    actions.push_back(strings.size());
+    strings.append(tables.actions[i]).push_back('\0');
+  }
+
+  TablesHeader header{};
+  std::memcpy(header.magic, tables_magic, sizeof(tables_magic));
+  header.version = tables_version;
+  header.byte_order = tables_byte_order;
+  header.nonterminals = tables.nonterminals;
+  header.start = tables.start;
+  header.rules = rules;
+  header.symbols = tables.symbol_offsets[rules];
+  header.action_args = tables.action_offsets[rules];
+  header.items = tables.items;
+  header.terminals = tables.terminals;
+  header.row_words = tables.row_words;
+  header.predictions = tables.prediction_offsets[tables.nonterminals];
+  header.strings = strings.size();
+
+  write_array(os, &header, 1);
+  write_array(os, tables.nullable, tables.nonterminals);
+  write_array(os, tables.rule_offsets, tables.nonterminals + 1);
+  write_array(os, tables.symbol_offsets, rules + 1);
+
+  // Written a field at a time so that the padding is zero.
+  for (size_t i = 0; i != header.symbols; ++i)
+  {
+    char symbol[sizeof(grammar::Symbol)] = {};
+    std::memcpy(symbol, &tables.symbols[i].index, sizeof(int));
+    symbol[offsetof(grammar::Symbol, terminal)] = tables.symbols[i].terminal;
+    os.write(symbol, sizeof(symbol));
+  }
+
+  write_array(os, names.data(), names.size());
+  write_array(os, actions.data(), actions.size());
+  write_array(os, tables.action_offsets, rules + 1);
+  write_array(os, tables.action_args, header.action_args);
+  write_array(os, tables.admissible,
+    (tables.terminals + 2) * tables.row_words);
+  write_array(os, tables.empty_rhs, tables.items);
+  write_array(os, tables.prediction_offsets, tables.nonterminals + 1);
+  write_array(os, tables.predictions, header.predictions);
+  write_array(os, strings.data(), strings.size());
+}
+
+MappedTables::MappedTables(const char* path)
+: m_file(path)
+{
+  if (m_file.data() == nullptr)
+  {
+    throw BadTables();
+  }
+
+  load(m_file.data(), m_file.size());
+}
+
+MappedTables::MappedTables(const char* data, size_t size)
+{
+  load(data, size);
+}
+
+void
+MappedTables::load(const char* data, size_t size)
+{
+  if (reinterpret_cast<uintptr_t>(data) % 8 != 0)
+  {
+    throw BadTables();
+  }
+
+  TablesReader reader(data, size);
+  auto& header = *reader.array<TablesHeader>(1);
+
+  if (std::memcmp(header.magic, tables_magic, sizeof(tables_magic)) != 0 ||
+    header.version != tables_version ||
+    header.byte_order != tables_byte_order)
+  {
+    throw BadTables();
+  }
+
+  auto nullable = reader.array<bool>(header.nonterminals);
+  auto rule_offsets = reader.array<uint32_t>(header.nonterminals + 1);
+  auto symbol_offsets = reader.array<uint32_t>(header.rules + 1);
+  auto symbols = reader.array<grammar::Symbol>(header.symbols);
+  auto names = reader.array<uint32_t>(header.nonterminals);
+  auto actions = reader.array<uint32_t>(header.rules);
+  auto action_offsets = reader.array<uint32_t>(header.rules + 1);
+  auto action_args = reader.array<uint32_t>(header.action_args);
+  auto admissible = reader.array<uint64_t>(
+    (header.terminals + 2) * header.row_words);
+  auto empty_rhs = reader.array<bool>(header.items);
+  auto prediction_offsets = reader.array<uint32_t>(header.nonterminals + 1);
+  auto predictions = reader.array<uint32_t>(header.predictions);
+  auto strings = reader.array<char>(header.strings);
+
+  // The arrays of offsets go up from zero to the size of what they index,
+  // each rule has an item for every dot, and every string is terminated.
+  if (!valid_offsets(rule_offsets, header.nonterminals, header.rules) ||
+    !valid_offsets(symbol_offsets, header.rules, header.symbols) ||
+    !valid_offsets(action_offsets, header.rules, header.action_args) ||
+    !valid_offsets(prediction_offsets, header.nonterminals,
+      header.predictions) ||
+    header.start < 0 ||
+    static_cast<uint64_t>(header.start) >= header.nonterminals ||
+    header.items != header.symbols + header.rules ||
+    header.row_words != (header.items + 63) / 64 ||
+    (header.strings != 0 && strings[header.strings - 1] != '\0'))
+  {
+    throw BadTables();
+  }
+
+  // Everything that is used as an index has to be in range, and the bools
+  // have to be bools.
+  for (size_t i = 0; i != header.symbols; ++i)
+  {
+    auto bytes = reinterpret_cast<const unsigned char*>(symbols + i);
+    auto terminal = bytes[offsetof(grammar::Symbol, terminal)];
+    auto limit = terminal ? header.terminals : header.nonterminals;
+
+    if (terminal > 1 || symbols[i].index < 0 ||
+      static_cast<uint64_t>(symbols[i].index) >= limit)
+    {
+      throw BadTables();
+    }
+  }
+
+  for (size_t i = 0; i != header.predictions; ++i)
+  {
+    if (predictions[i] >= header.items)
+    {
+      throw BadTables();
+    }
+  }
+
+  if (!valid_bools(nullable, header.nonterminals) ||
+    !valid_bools(empty_rhs, header.items))
+  {
+    throw BadTables();
+  }
+
+  auto string = [&](uint32_t offset) {
+    if (offset >= header.strings)
+    {
+      throw BadTables();
+    }
+    return strings + offset;
+  };
+
+  for (size_t i = 0; i != header.nonterminals; ++i)
+  {
+    m_names.push_back(string(names[i]));
+  }
+  for (size_t i = 0; i != header.rules; ++i)
+  {
+    m_actions.push_back(string(actions[i]));
+  }
+
+  m_tables = GrammarTables{
+    header.nonterminals,
+    static_cast<int>(header.start),
+    m_names.data(),
+    nullable,
+    rule_offsets,
+    symbol_offsets,
+    symbols,
+    m_actions.data(),
+    action_offsets,
+    action_args,
+    header.items,
+    header.terminals,
+    header.row_words,
+    admissible,
+    empty_rhs,
+    prediction_offsets,
+    predictions,
+  };
+}
+
+}
@@ -15,9 +15,17 @@ namespace
     const char*,
     const earley::Grammar&,
     const earley::TerminalMap&,
+    const earley::fast::CompiledGrammar&,
     const std::string&
   );
 
+  void
+  write_table_source(
+    std::ostream&,
+    const char*,
+    const earley::fast::GrammarTables&
+  );
+
   void
   print_node(std::ostream& os, const earley::Production& node);
 
@@ -88,7 +96,9 @@ generate_grammar(const char* prefix, const char* input, const char* output)
     throw Terminate();
   }
 
-  write_grammar(prefix, grammar, terminals, output);
+  auto compiled = earley::fast::compile(built);
+
+  write_grammar(prefix, grammar, terminals, *compiled, output);
 }
 
 void
@@ -96,6 +106,7 @@ write_grammar(
   const char* prefix,
   const earley::Grammar& grammar,
   const earley::TerminalMap& terminals,
+  const earley::fast::CompiledGrammar& compiled,
   const std::string& output_prefix
 )
 {
@@ -145,16 +156,162 @@ write_grammar(
     }
     os << "  }},\n";
   }
-  os << "};\n";
+  os << "};\n\n";
+
+  earley::fast::BuiltTables built(compiled);
+  write_table_source(os, prefix, built.tables());
 
   std::ofstream of((output_prefix + ".cpp").c_str());
   of << os.str();
 
   std::ofstream header((output_prefix + ".hpp").c_str());
-  header << "#include<earley.hpp>\n\n"
+  header << "#include<earley.hpp>\n"
+         << "#include<earley/fast/tables.hpp>\n\n"
          << "extern earley::TerminalMap " << prefix << "_terminals;\n"
-         << "extern earley::Grammar " << prefix << "_grammar;\n\n"
+         << "extern earley::Grammar " << prefix << "_grammar;\n"
+         << "extern const earley::fast::GrammarTables " << prefix
+         << "_tables;\n\n"
          << tokens.str();
+
+  // The same tables, for programs that load the grammar at run time.
+  std::ofstream binary((output_prefix + ".tables").c_str(),
+    std::ios::binary);
+  earley::fast::write_tables(binary, built.tables());
+}
+
+std::string
+quote(const std::string& s)
+{
+  std::string quoted = "\"";
+  for (auto c: s)
+  {
+    if (c == '"' || c == '\\')
+    {
+      quoted += '\\';
+    }
+    quoted += c;
+  }
+  quoted += '"';
+
+  return quoted;
+}
+
+template <typename T>
+std::string
+to_string(const T& value)
+{
+  std::ostringstream os;
+  os << value;
+  return os.str();
+}
+
+// Writes `values` as a constexpr array, eight to a line.
+void
+write_array(
+  std::ostream& os,
+  const char* type,
+  const char* name,
+  const std::vector<std::string>& values
+)
+{
+  os << "  constexpr " << type << " " << name << "[] = {";
+  for (size_t i = 0; i != values.size(); ++i)
+  {
+    os << (i % 8 == 0 ? "\n    " : " ") << values[i] << ",";
+  }
+
+  // An array can't be empty.
+  if (values.empty())
+  {
+    os << "\n    {},";
+  }
+  os << "\n  };\n\n";
+}
+
+template <typename T, typename Format>
+std::vector<std::string>
+format(const T* values, size_t size, Format format)
+{
+  std::vector<std::string> formatted;
+  for (size_t i = 0; i != size; ++i)
+  {
+    formatted.push_back(format(values[i]));
+  }
+
+  return formatted;
+}
+
+void
+write_table_source(
+  std::ostream& os,
+  const char* prefix,
+  const earley::fast::GrammarTables& tables
+)
+{
+  auto rules = tables.rule_offsets[tables.nonterminals];
+  auto symbols = tables.symbol_offsets[rules];
+
+  auto number = [](auto n) { return to_string(n); };
+  auto boolean = [](bool b) -> std::string { return b ? "true" : "false"; };
+  auto string = [](const char* s) { return quote(s); };
+  auto symbol = [](const earley::fast::grammar::Symbol& s) {
+    return "{" + to_string(s.index) + ", " + (s.terminal ? "true" : "false") +
+      "}";
+  };
+  auto hex = [](uint64_t word) {
+    std::ostringstream os;
+    os << "0x" << std::hex << word << "ull";
+    return os.str();
+  };
+
+  os << "namespace\n{\n";
+  write_array(os, "const char*", "names",
+    format(tables.names, tables.nonterminals, string));
+  write_array(os, "bool", "nullable",
+    format(tables.nullable, tables.nonterminals, boolean));
+  write_array(os, "uint32_t", "rule_offsets",
+    format(tables.rule_offsets, tables.nonterminals + 1, number));
+  write_array(os, "uint32_t", "symbol_offsets",
+    format(tables.symbol_offsets, rules + 1, number));
+  write_array(os, "earley::fast::grammar::Symbol", "symbols",
+    format(tables.symbols, symbols, symbol));
+  write_array(os, "const char*", "actions",
+    format(tables.actions, rules, string));
+  write_array(os, "uint32_t", "action_offsets",
+    format(tables.action_offsets, rules + 1, number));
+  write_array(os, "uint32_t", "action_args",
+    format(tables.action_args, tables.action_offsets[rules], number));
+  write_array(os, "uint64_t", "admissible",
+    format(tables.admissible, (tables.terminals + 2) * tables.row_words,
+      hex));
+  write_array(os, "bool", "empty_rhs",
+    format(tables.empty_rhs, tables.items, boolean));
+  write_array(os, "uint32_t", "prediction_offsets",
+    format(tables.prediction_offsets, tables.nonterminals + 1, number));
+  write_array(os, "uint32_t", "predictions",
+    format(tables.predictions,
+      tables.prediction_offsets[tables.nonterminals], number));
+  os << "}\n\n";
+
+  os << "constexpr earley::fast::GrammarTables " << prefix << "_tables{\n"
+     << "  " << tables.nonterminals << ",\n"
+     << "  " << tables.start << ",\n"
+     << "  names,\n"
+     << "  nullable,\n"
+     << "  rule_offsets,\n"
+     << "  symbol_offsets,\n"
+     << "  symbols,\n"
+     << "  actions,\n"
+     << "  action_offsets,\n"
+     << "  action_args,\n"
+     << "  " << tables.items << ",\n"
+     << "  " << tables.terminals << ",\n"
+     << "  " << tables.row_words << ",\n"
+     << "  admissible,\n"
+     << "  empty_rhs,\n"
+     << "  prediction_offsets,\n"
+     << "  predictions,\n"
+     << "};\n";
 }
 
 struct NodePrinter
@@ -1,7 +1,14 @@
 #include "catch.hpp"
 #include "earley/fast.hpp"
+#include "earley/fast/actions.hpp"
 #include "earley/fast/grammar.hpp"
 #include "earley/fast/items.hpp"
+#include "earley/fast/parallel.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <memory_resource>
+#include <sstream>
 
 using namespace earley::fast::grammar;
 using namespace earley::fast;
@@ -171,6 +178,16 @@ TEST_CASE("Items generation", "[items]")
   CHECK(i000->end() == r00->end());
   CHECK(i000->dot() == r00->begin());
   CHECK(i000->dot() == i000->position());
+
+  // The items of a rule are next to each other.
+  auto i002 = items.get_item(r00, 2);
+  CHECK(i000->next() == i001);
+  CHECK(i001->next() == i002);
+  CHECK(i002->previous() == i001);
+  CHECK(!i001->complete());
+  CHECK(i002->complete());
+  CHECK(items.item(i001->index()) == i001);
+  CHECK(items.items() == 5);
 }
 
 SCENARIO("First set of symbol sequence", "[firsts]")
@@ -351,6 +368,31 @@ SCENARIO("Follow set", "[follow]")
   }
 }
 
+TEST_CASE("Mutually recursive sets", "[firsts]")
+{
+  // A -> B 'a' | 'x'
+  // B -> A 'b' | <empty>
+  std::vector<RuleList> rules
+  {
+    {
+      {0, {{1, false}, {'a', true}}},
+      {0, {{'x', true}}},
+    },
+    {
+      {1, {{0, false}, {'b', true}}},
+      {1, {}},
+    },
+  };
+
+  auto firsts = first_sets(rules);
+  CHECK(firsts[0] == std::unordered_set<int>{'a', 'x'});
+  CHECK(firsts[1] == std::unordered_set<int>{'a', 'x', EPSILON});
+
+  auto follows = follow_sets(0, rules, firsts);
+  CHECK(follows[0] == std::unordered_set<int>{'b', END_OF_INPUT});
+  CHECK(follows[1] == std::unordered_set<int>{'a'});
+}
+
 TEST_CASE("Sequence lookahead", "[lookahead]")
 {
   std::vector<RuleList> rules
@@ -413,11 +455,12 @@ TEST_CASE("ItemSet distances", "[itemset]")
 
   Rule& r1 = rules[1][0];
 
-  Item first(&r1, r1.begin(), earley::HashSet<int>());
-  Item second(&r1, r1.begin()+1, earley::HashSet<int>());
+  Item first(&r1, r1.begin(), false, 0);
+  Item second(&r1, r1.begin()+1, false, 1);
 
-  ItemSetCore core;
-  ItemSet set(&core);
+  earley::fast::ParseArenas arenas;
+  ItemSetCore core(arenas.cores);
+  ItemSet set(&core, arenas);
 
   set.add_start_item(&first, 2);
   set.add_derived_item(&second, 0);
@@ -425,3 +468,1318 @@ TEST_CASE("ItemSet distances", "[itemset]")
   CHECK(set.actual_distance(0) == 2);
   CHECK(set.actual_distance(1) == 2);
 }
+
+TEST_CASE("Interleaved parsers", "[parser]")
+{
+  earley::Grammar grammar{
+    {
+      "S", {
+        {{'a'}},
+        {{"S", '+', 'a'}},
+      },
+    },
+  };
+
+  Grammar built("S", grammar);
+
+  TerminalList first{'a', '+', 'a', '+', 'a'};
+  TerminalList second{'a', '+', 'a'};
+
+  earley::fast::Parser p1(built, first);
+  earley::fast::Parser p2(built, second);
+
+  // Each parser has its own arenas, so alternating between them must not
+  // disturb the other one's current set.
+  for (size_t i = 0; i != first.size(); ++i)
+  {
+    CHECK_NOTHROW(p1.parse(i));
+    if (i < second.size())
+    {
+      CHECK_NOTHROW(p2.parse(i));
+    }
+  }
+
+  CHECK(p1.accepted());
+  CHECK(p2.accepted());
+
+  // The sets are the same as those of a parser that ran on its own.
+  auto same_sets = [](const earley::fast::Parser& interleaved,
+    const earley::fast::Parser& alone, size_t sets)
+  {
+    for (size_t i = 0; i <= sets; ++i)
+    {
+      auto set = interleaved.set(i);
+      auto expected = alone.set(i);
+      REQUIRE(set->core()->all_items() == expected->core()->all_items());
+
+      for (size_t j = 0; j != set->core()->all_items(); ++j)
+      {
+        CHECK(set->core()->item(j)->index() ==
+          expected->core()->item(j)->index());
+        CHECK(set->actual_distance(j) == expected->actual_distance(j));
+      }
+    }
+  };
+
+  earley::fast::Parser alone1(built, first);
+  alone1.parse_input();
+  same_sets(p1, alone1, first.size());
+
+  earley::fast::Parser alone2(built, second);
+  alone2.parse_input();
+  same_sets(p2, alone2, second.size());
+}
+
+TEST_CASE("Shared compiled grammar", "[compiled]")
+{
+  earley::Grammar grammar{
+    {
+      "S", {
+        {{'a'}},
+        {{"S", '+', 'a'}},
+      },
+    },
+  };
+
+  auto compiled = compile(Grammar("S", grammar));
+  auto& rule = compiled->rules(compiled->start()).front();
+
+  CHECK(compiled->items() > 0);
+  CHECK(compiled->get_item(&rule, 0)->dot() == rule.begin());
+
+  TerminalList input{'a', '+', 'a'};
+
+  {
+    earley::fast::Parser shared(compiled, input);
+    earley::fast::Parser borrowed(*compiled, input);
+    CHECK(compiled.use_count() == 2);
+
+    for (size_t i = 0; i != input.size(); ++i)
+    {
+      CHECK_NOTHROW(shared.parse(i));
+      CHECK_NOTHROW(borrowed.parse(i));
+    }
+  }
+
+  CHECK(compiled.use_count() == 1);
+}
+
+namespace
+{
+  // Counts the bytes that are still allocated through it.
+  class CountingResource : public std::pmr::memory_resource
+  {
+    public:
+    size_t allocated = 0;
+    size_t allocations = 0;
+
+    private:
+    void*
+    do_allocate(size_t bytes, size_t alignment) override
+    {
+      allocated += bytes;
+      ++allocations;
+      return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void
+    do_deallocate(void* p, size_t bytes, size_t alignment) override
+    {
+      allocated -= bytes;
+      std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool
+    do_is_equal(const std::pmr::memory_resource& other) const
+      noexcept override
+    {
+      return this == &other;
+    }
+  };
+
+  // Sets the default resource while it is in scope.
+  class DefaultResource
+  {
+    public:
+    DefaultResource(std::pmr::memory_resource* resource)
+    : m_previous(std::pmr::set_default_resource(resource))
+    {
+    }
+
+    ~DefaultResource()
+    {
+      std::pmr::set_default_resource(m_previous);
+    }
+
+    private:
+    std::pmr::memory_resource* m_previous;
+  };
+}
+
+TEST_CASE("Parse memory resource", "[resource]")
+{
+  earley::Grammar grammar{
+    {
+      "S", {
+        {{'a'}},
+        {{"S", '+', 'a'}},
+      },
+    },
+  };
+
+  auto compiled = compile(Grammar("S", grammar));
+  TerminalList input{'a', '+', 'a', '+', 'a'};
+
+  CountingResource counting;
+  {
+    // Nothing is allocated from the default resource.
+    DefaultResource null(std::pmr::null_memory_resource());
+
+    earley::fast::Parser parser(*compiled, input, &counting);
+    CHECK(counting.allocations > 0);
+
+    parser.parse_input();
+    CHECK(parser.accepted());
+
+    parser.create_reductions();
+    CHECK(parser.forest().nodes() > 0);
+
+    TerminalList edited{'a', '+', 'a', '+', 'a', '+', 'a'};
+    parser.reparse(3, 3, edited);
+    CHECK(parser.accepted());
+  }
+
+  // Everything the parser allocated went back to the resource.
+  CHECK(counting.allocated == 0);
+
+  // A monotonic buffer frees the whole parse at once when it goes.
+  std::pmr::monotonic_buffer_resource buffer(&counting);
+  {
+    earley::fast::Parser parser(*compiled, input, &buffer);
+    parser.parse_input();
+    CHECK(parser.accepted());
+  }
+  CHECK(counting.allocated > 0);
+  buffer.release();
+  CHECK(counting.allocated == 0);
+}
+
+TEST_CASE("Cores are kept between parses", "[cores]")
+{
+  earley::Grammar grammar{
+    {
+      "S", {
+        {{'a'}},
+        {{"S", '+', 'a'}},
+        {{"S", '*', 'a'}},
+      },
+    },
+  };
+
+  auto compiled = compile(Grammar("S", grammar));
+  auto& cores = compiled->cores();
+
+  TerminalList input{'a', '+', 'a', '*', 'a'};
+
+  {
+    earley::fast::Parser parser(compiled, input);
+    parser.parse_input();
+  }
+
+  auto built = cores.size();
+  CHECK(built > 1);
+
+  {
+    earley::fast::Parser parser(compiled, input);
+    parser.parse_input();
+  }
+
+  CHECK(cores.size() == built);
+}
+
+TEST_CASE("Core transitions", "[cores]")
+{
+  earley::Grammar grammar{
+    {
+      "S", {
+        {{'a'}},
+        {{"S", '+', 'a'}},
+        {{"S", '*', 'a'}},
+      },
+    },
+  };
+
+  auto compiled = compile(Grammar("S", grammar));
+
+  TerminalList input{'a', '+', 'a', '*', 'a'};
+  earley::fast::Parser parser(compiled, input);
+  parser.parse_input();
+
+  // Every item with a symbol after the dot is in the transitions for that
+  // symbol, in order, and nothing else is.
+  for (size_t position = 0; position <= input.size(); ++position)
+  {
+    auto core = parser.set(position)->core();
+    for (size_t i = 0; i != core->all_items(); ++i)
+    {
+      auto item = core->item(i);
+      if (item->complete())
+      {
+        continue;
+      }
+
+      auto transitions = core->transitions(*item->dot());
+      CHECK(std::is_sorted(transitions.begin(), transitions.end()));
+      CHECK(std::count(transitions.begin(), transitions.end(), i) == 1);
+
+      for (auto transition: transitions)
+      {
+        CHECK(*core->item(transition)->dot() == *item->dot());
+      }
+    }
+
+    auto none = core->transitions({'x', true});
+    CHECK(none.begin() == none.end());
+  }
+}
+
+TEST_CASE("Streamed input", "[stream]")
+{
+  earley::Grammar grammar{
+    {
+      "S", {
+        {{'a'}},
+        {{"S", '+', 'a'}},
+      },
+    },
+  };
+
+  auto compiled = compile(Grammar("S", grammar));
+
+  SECTION("A complete sentence")
+  {
+    earley::fast::Parser parser(compiled);
+
+    for (auto token: {'a', '+', 'a', '+', 'a'})
+    {
+      parser.feed(token);
+    }
+
+    CHECK(parser.finish());
+  }
+
+  SECTION("An incomplete sentence")
+  {
+    earley::fast::Parser parser(compiled);
+
+    parser.feed('a');
+    parser.feed('+');
+
+    CHECK(!parser.finish());
+  }
+
+  SECTION("The same result as the whole input")
+  {
+    TerminalList input{'a', '+', 'a'};
+    earley::fast::Parser whole(compiled, input);
+    earley::fast::Parser streamed(compiled);
+
+    for (size_t i = 0; i != input.size(); ++i)
+    {
+      whole.parse(i);
+      streamed.feed(input[i]);
+    }
+
+    CHECK(streamed.finish());
+    CHECK(whole.accepted());
+  }
+}
+
+TEST_CASE("Reparse an edit", "[reparse]")
+{
+  earley::Grammar grammar{
+    {
+      "S", {
+        {{'x'}},
+        {{'y'}},
+        {{"S", '+', 'x'}},
+        {{"S", '+', 'y'}},
+      },
+    },
+  };
+
+  auto compiled = compile(Grammar("S", grammar));
+
+  TerminalList input{'x'};
+  for (int i = 0; i != 20; ++i)
+  {
+    input.insert(input.end(), {'+', 'x'});
+  }
+
+  earley::fast::Parser parser(compiled, input);
+  parser.parse_input();
+  REQUIRE(parser.accepted());
+
+  SECTION("Replacing a token")
+  {
+    auto edited = input;
+    edited[10] = 'y';
+
+    auto reparsed = parser.reparse(10, 11, edited);
+
+    CHECK(parser.accepted());
+    CHECK(reparsed < 5);
+  }
+
+  SECTION("Inserting tokens")
+  {
+    auto edited = input;
+    edited.insert(edited.begin() + 11, {'+', 'y'});
+
+    auto reparsed = parser.reparse(11, 11, edited);
+
+    CHECK(parser.accepted());
+
+    // Every item of the list started before the edit, and the number of
+    // tokens changed, so it parses up to the end.
+    CHECK(reparsed == edited.size() - 10);
+  }
+
+  SECTION("Streamed input")
+  {
+    earley::fast::Parser streamed(compiled);
+    streamed.feed('x');
+    CHECK_THROWS_AS(streamed.reparse(0, 1, input), std::logic_error);
+  }
+
+  SECTION("Deleting the last token")
+  {
+    auto edited = input;
+    edited.pop_back();
+
+    parser.reparse(edited.size(), input.size(), edited);
+
+    CHECK(!parser.accepted());
+  }
+}
+
+TEST_CASE("Checkpoint and rollback", "[checkpoint]")
+{
+  earley::Grammar grammar{
+    {
+      "S", {
+        {{'x'}},
+        {{'y'}},
+        {{"S", '+', 'x'}},
+        {{"S", '+', 'y'}},
+      },
+    },
+  };
+
+  auto compiled = compile(Grammar("S", grammar));
+
+  earley::fast::Parser parser(compiled);
+  parser.feed('x');
+  parser.feed('+');
+
+  auto checkpoint = parser.checkpoint();
+
+  SECTION("Try alternatives")
+  {
+    parser.feed('y');
+    CHECK(parser.finish());
+
+    parser.rollback(checkpoint);
+    parser.feed('x');
+    parser.feed('+');
+    CHECK(!parser.finish());
+
+    parser.rollback(checkpoint);
+    parser.feed('x');
+    parser.feed('+');
+    parser.feed('x');
+    CHECK(parser.finish());
+  }
+
+  SECTION("A checkpoint after the rollback is stale")
+  {
+    parser.feed('x');
+    parser.feed('+');
+    auto later = parser.checkpoint();
+
+    parser.rollback(checkpoint);
+    parser.feed('y');
+    parser.feed('+');
+    parser.feed('y');
+
+    CHECK_THROWS_AS(parser.rollback(later), earley::fast::StaleCheckpoint);
+    CHECK_NOTHROW(parser.rollback(checkpoint));
+  }
+}
+
+TEST_CASE("Recogniser", "[recognise]")
+{
+  earley::Grammar grammar{
+    {
+      "S", {
+        {{'x'}},
+        {{'y'}},
+        {{"S", '+', 'x'}},
+        {{"S", '+', 'y'}},
+      },
+    },
+  };
+
+  auto compiled = compile(Grammar("S", grammar));
+
+  SECTION("Accepted")
+  {
+    TerminalList input{'x', '+', 'y', '+', 'x'};
+    earley::fast::Parser parser(compiled, input);
+
+    CHECK(!parser.recognise());
+  }
+
+  SECTION("Unexpected token")
+  {
+    TerminalList input{'x', '+', '+', 'y'};
+    earley::fast::Parser parser(compiled, input);
+
+    auto error = parser.recognise();
+    REQUIRE(error);
+    CHECK(error->position == 2);
+    CHECK(parser.expected(*error) == std::vector<size_t>{'x', 'y'});
+  }
+
+  SECTION("Incomplete")
+  {
+    TerminalList input{'x', '+'};
+    earley::fast::Parser parser(compiled, input);
+
+    auto error = parser.recognise();
+    REQUIRE(error);
+    CHECK(error->position == 2);
+    CHECK(parser.expected(*error) == std::vector<size_t>{'x', 'y'});
+  }
+
+  SECTION("Streamed input")
+  {
+    earley::fast::Parser parser(compiled);
+    parser.feed('x');
+    CHECK_THROWS_AS(parser.recognise(), std::logic_error);
+  }
+
+  SECTION("Carry on after an error")
+  {
+    earley::fast::Parser parser(compiled);
+    parser.feed('x');
+    parser.feed('+');
+    auto checkpoint = parser.checkpoint();
+
+    parser.feed('+');
+    CHECK_THROWS(parser.feed('y'));
+
+    parser.rollback(checkpoint);
+    parser.feed('y');
+    CHECK(parser.finish());
+  }
+}
+
+TEST_CASE("Parallel recognition", "[parallel]")
+{
+  earley::Grammar grammar{
+    {
+      "P", {
+        {{"L"}},
+      },
+    },
+    {
+      "L", {
+        {{"D"}},
+        {{"L", "D"}},
+      },
+    },
+    {
+      "D", {
+        {{'a', ';'}},
+        {{'{', "L", '}'}},
+        {{'{', '}', ';'}},
+      },
+    },
+  };
+
+  auto compiled = compile(Grammar("P", grammar));
+  CutTerminals terminals{{';', '}'}, {{'{', '}'}}};
+
+  TerminalList input;
+  for (int i = 0; i != 50; ++i)
+  {
+    for (auto c: {"a;{a;{};}a;", "{};a;", "{a;}"})
+    {
+      input.insert(input.end(), c, c + std::strlen(c));
+    }
+  }
+
+  SECTION("Cut points")
+  {
+    TerminalList small{'a', ';', '{', 'a', ';', '}', '{', '}', ';'};
+    CHECK(cut_points(small, terminals) == std::vector<size_t>{2, 6, 9});
+  }
+
+  SECTION("Accepted")
+  {
+    ParallelParser parser(*compiled, 2);
+
+    CHECK(!parser.recognise(input, cut_points(input, terminals)));
+    CHECK(parser.stats().chunks > 1);
+    CHECK(parser.stats().rounds == 1);
+    CHECK(parser.stats().reparsed == 0);
+  }
+
+  SECTION("Wrong cuts")
+  {
+    // Every position is a guess, so most of the chunks have to be joined.
+    std::vector<size_t> cuts;
+    for (size_t i = 1; i != input.size(); ++i)
+    {
+      cuts.push_back(i);
+    }
+
+    ParallelParser parser(*compiled, 3);
+    CHECK(!parser.recognise(input, cuts));
+    CHECK(parser.stats().rounds > 1);
+  }
+
+  SECTION("Same error as one parser")
+  {
+    for (auto position: {size_t(3), input.size() / 2, input.size() - 1})
+    {
+      auto wrong = input;
+      wrong[position] = 'x';
+
+      earley::fast::Parser sequential(compiled, wrong);
+      auto expected = sequential.recognise();
+      REQUIRE(expected);
+
+      ParallelParser parser(*compiled, 2);
+      auto error = parser.recognise(wrong, cut_points(wrong, terminals));
+      REQUIRE(error);
+      CHECK(error->position == expected->position);
+    }
+
+    TerminalList unfinished(input.begin(), input.end() - 1);
+    ParallelParser parser(*compiled, 2);
+    auto error = parser.recognise(unfinished,
+      cut_points(unfinished, terminals));
+    REQUIRE(error);
+    CHECK(error->position == unfinished.size());
+  }
+
+  SECTION("Not a list")
+  {
+    earley::Grammar nested{
+      {
+        "S", {
+          {{'a'}},
+          {{'{', "S", '}'}},
+        },
+      },
+    };
+
+    auto not_list = compile(Grammar("S", nested));
+    CHECK_THROWS_AS(ParallelParser(*not_list, 2), NotAList);
+
+    // At most one D, so `x;x;` isn't a sentence even though each half is.
+    earley::Grammar optional{
+      {"P", {
+        {{"S"}},
+      }},
+      {"S", {
+        {{"D"}},
+        {{}},
+      }},
+      {"D", {
+        {{'x', ';'}},
+      }},
+    };
+
+    auto not_repeated = compile(Grammar("P", optional));
+    CHECK_THROWS_AS(ParallelParser(*not_repeated, 4), NotAList);
+  }
+}
+
+TEST_CASE("Set membership", "[membership]")
+{
+  earley::fast::Membership membership(2);
+
+  CHECK(membership.insert(1, 0));
+  CHECK(membership.insert(1, 100000));
+  CHECK(!membership.insert(1, 0));
+
+  // More than the table can hold to start with.
+  for (int i = 0; i != 20; ++i)
+  {
+    CHECK(membership.insert(2, i));
+  }
+  CHECK(!membership.insert(1, 100000));
+  CHECK(!membership.insert(2, 19));
+
+  membership.next();
+  CHECK(membership.insert(1, 0));
+  CHECK(membership.insert(2, 19));
+}
+
+TEST_CASE("Reduction forest", "[forest]")
+{
+  earley::Grammar grammar{
+    {
+      "S", {
+        {{'x'}},
+        {{'y'}},
+        {{"S", '+', 'x'}},
+        {{"S", '+', 'y'}},
+      },
+    },
+  };
+
+  auto compiled = compile(Grammar("S", grammar));
+  auto& rules = compiled->grammar().rules("S");
+
+  TerminalList input{'x', '+', 'y'};
+  earley::fast::Parser parser(compiled, input);
+  parser.parse_input();
+  parser.create_reductions();
+
+  auto& forest = parser.forest();
+  using Forest = earley::fast::Forest;
+
+  earley::fast::grammar::Symbol S{rules[0].nonterminal(), false};
+  auto x = *rules[0].begin();
+  auto y = *rules[1].begin();
+  auto plus = *(rules[2].begin() + 1);
+
+  // The start rule derives S over the whole input.
+  auto root = forest.root();
+  REQUIRE(root != Forest::no_node);
+  CHECK(forest.kind(root) == Forest::Kind::nonterminal);
+  CHECK(forest.symbol(root).index == compiled->start());
+  CHECK(forest.start(root) == 0);
+  CHECK(forest.end(root) == 3);
+
+  auto packed = forest.packed(root);
+  REQUIRE(packed.end() - packed.begin() == 1);
+  CHECK(packed[0].left == Forest::no_node);
+  CHECK(forest.find(S, 0, 3) == packed[0].right);
+
+  // S -> S + y.
+  packed = forest.packed(packed[0].right);
+  REQUIRE(packed.end() - packed.begin() == 1);
+  CHECK(packed[0].item == compiled->get_item(&rules[3], 3));
+  CHECK(forest.kind(packed[0].right) == Forest::Kind::terminal);
+  CHECK(forest.symbol(packed[0].right) == y);
+  CHECK(forest.start(packed[0].right) == 2);
+  CHECK(forest.packed(packed[0].right).begin() ==
+    forest.packed(packed[0].right).end());
+
+  // S + before the y.
+  auto prefix = packed[0].left;
+  CHECK(forest.find(compiled->get_item(&rules[3], 2), 0, 2) == prefix);
+  CHECK(forest.kind(prefix) == Forest::Kind::intermediate);
+  CHECK(forest.item(prefix) == compiled->get_item(&rules[3], 2));
+
+  packed = forest.packed(prefix);
+  REQUIRE(packed.end() - packed.begin() == 1);
+  CHECK(forest.symbol(packed[0].right) == plus);
+  CHECK(forest.find(S, 0, 1) == packed[0].left);
+
+  // The x reduced to S.
+  packed = forest.packed(packed[0].left);
+  REQUIRE(packed.end() - packed.begin() == 1);
+  CHECK(packed[0].item == compiled->get_item(&rules[0], 1));
+  CHECK(packed[0].left == Forest::no_node);
+  CHECK(forest.find(x, 0, 1) == packed[0].right);
+
+  // Only the nodes under the root are made.
+  CHECK(forest.nodes() == 7);
+  CHECK(forest.packed_nodes() == 4);
+  CHECK(!forest.find(compiled->get_item(&rules[2], 2), 0, 2));
+}
+
+namespace
+{
+  // The number of trees under a node of the forest.
+  size_t
+  count_trees(const earley::fast::Forest& forest,
+    earley::fast::Forest::Node node, std::vector<size_t>& counts)
+  {
+    using Forest = earley::fast::Forest;
+
+    if (node == Forest::no_node || forest.kind(node) == Forest::Kind::terminal)
+    {
+      return 1;
+    }
+
+    if (counts[node] == 0)
+    {
+      for (auto& packed: forest.packed(node))
+      {
+        counts[node] += count_trees(forest, packed.left, counts) *
+          count_trees(forest, packed.right, counts);
+      }
+    }
+
+    return counts[node];
+  }
+}
+
+TEST_CASE("Ambiguous forest", "[forest]")
+{
+  earley::Grammar grammar{
+    {
+      "E", {
+        {{"E", '+', "E"}},
+        {{'n'}},
+        {{}},
+      },
+    },
+  };
+
+  auto compiled = compile(Grammar("E", grammar));
+  auto& rules = compiled->grammar().rules("E");
+  earley::fast::grammar::Symbol E{rules[0].nonterminal(), false};
+
+  TerminalList input{'n', '+', 'n', '+', 'n'};
+  earley::fast::Parser parser(compiled, input);
+  parser.parse_input();
+  parser.create_reductions();
+
+  auto& forest = parser.forest();
+  auto root = forest.root();
+  REQUIRE(root != earley::fast::Forest::no_node);
+
+  // (n+n)+n and n+(n+n).
+  auto whole = forest.find(E, 0, 5);
+  REQUIRE(whole);
+  auto packed = forest.packed(*whole);
+  CHECK(packed.end() - packed.begin() == 2);
+
+  std::vector<size_t> counts(forest.nodes());
+  CHECK(count_trees(forest, root, counts) == 2);
+
+  // The two trees share the E nodes of each n.
+  for (size_t i = 0; i < 5; i += 2)
+  {
+    auto n = forest.find(E, i, i + 1);
+    REQUIRE(n);
+    CHECK(count_trees(forest, *n, counts) == 1);
+  }
+
+  SECTION("Empty rule")
+  {
+    TerminalList plus{'+'};
+    earley::fast::Parser parser(compiled, plus);
+    parser.parse_input();
+    parser.create_reductions();
+
+    auto& forest = parser.forest();
+    auto packed = forest.packed(*forest.find(E, 0, 1));
+    REQUIRE(packed.end() - packed.begin() == 1);
+
+    auto empty = forest.packed(*forest.find(E, 0, 0));
+    REQUIRE(empty.end() - empty.begin() == 1);
+    CHECK(empty[0].item == compiled->get_item(&rules[2], 0));
+    CHECK(empty[0].left == earley::fast::Forest::no_node);
+    CHECK(empty[0].right == earley::fast::Forest::no_node);
+  }
+}
+
+namespace
+{
+  typedef earley::ActionResult<int> SumResult;
+  typedef std::vector<SumResult> SumParts;
+
+  SumResult
+  sum_pass(SumParts& parts)
+  {
+    return parts[0];
+  }
+
+  SumResult
+  sum_digit(SumParts& parts)
+  {
+    return earley::get<char>(parts[0]) - '0';
+  }
+
+  SumResult
+  sum_add(SumParts& parts)
+  {
+    return earley::get<int>(parts[0]) + earley::get<int>(parts[1]);
+  }
+}
+
+TEST_CASE("Run actions", "[actions]")
+{
+  std::vector<earley::RuleWithAction> digits;
+  for (char c = '0'; c <= '9'; ++c)
+  {
+    digits.push_back({{c}, {"digit", {0}}});
+  }
+
+  earley::Grammar grammar{
+    {"Sum", {
+      {{"Sum", '+', "Digit"}, {"add", {0, 2}}},
+      {{"Digit"}, {"pass", {0}}},
+    }},
+    {"Digit", digits},
+    {"Input", {
+      {{"Space", "Sum", "Space"}, {"pass", {1}}},
+    }},
+    {"Space", {
+      {{}},
+      {{"Space", ' '}},
+    }},
+  };
+
+  std::unordered_map<std::string, SumResult(*)(SumParts&)> actions{
+    {"pass", &sum_pass},
+    {"digit", &sum_digit},
+    {"add", &sum_add},
+  };
+
+  auto compiled = compile(Grammar("Input", grammar));
+
+  std::string text = "  1+2+3+4 ";
+  TerminalList input(text.begin(), text.end());
+  earley::fast::Parser parser(compiled, input);
+  parser.parse_input();
+
+  auto result = earley::fast::run_actions(parser, input, actions);
+  REQUIRE(earley::holds<int>(result));
+  CHECK(earley::get<int>(result) == 10);
+
+  // Each element of a left recursive list nests inside the next one, which
+  // mustn't run out of stack.
+  text = "1";
+  for (int i = 1; i != 50000; ++i)
+  {
+    text += "+1";
+  }
+
+  TerminalList long_input(text.begin(), text.end());
+  earley::fast::Parser long_parser(compiled, long_input);
+  long_parser.parse_input();
+
+  result = earley::fast::run_actions(long_parser, long_input, actions);
+  REQUIRE(earley::holds<int>(result));
+  CHECK(earley::get<int>(result) == 50000);
+}
+
+namespace
+{
+  typedef earley::ActionResult<int, size_t> IdResult;
+  typedef std::vector<IdResult> IdParts;
+
+  IdResult
+  id_pass(IdParts& parts)
+  {
+    return parts[0];
+  }
+}
+
+TEST_CASE("Token ids in actions", "[actions]")
+{
+  earley::Grammar grammar{
+    {"S", {
+      {{"WORD"}, {"pass", {0}}},
+    }},
+  };
+
+  auto compiled = compile(Grammar("S", grammar, {{"WORD", 300}}));
+
+  TerminalList input{300};
+  earley::fast::Parser parser(compiled, input);
+  parser.parse_input();
+
+  // The id is given as it is to a result that can hold it.
+  std::unordered_map<std::string, IdResult(*)(IdParts&)> id_actions{
+    {"pass", &id_pass},
+  };
+
+  auto result = earley::fast::run_actions(parser, input, id_actions);
+  REQUIRE(earley::holds<size_t>(result));
+  CHECK(earley::get<size_t>(result) == 300);
+
+  // A char can't hold it.
+  std::unordered_map<std::string, SumResult(*)(SumParts&)> char_actions{
+    {"pass", &sum_pass},
+  };
+
+  CHECK_THROWS_AS(earley::fast::run_actions(parser, input, char_actions),
+    std::out_of_range);
+}
+
+TEST_CASE("Lazy forest", "[forest]")
+{
+  earley::Grammar grammar{
+    {
+      "S", {
+        {{'x'}},
+        {{'y'}},
+        {{"S", '+', 'x'}},
+        {{"S", '+', 'y'}},
+      },
+    },
+  };
+
+  auto compiled = compile(Grammar("S", grammar));
+  auto& rules = compiled->grammar().rules("S");
+
+  TerminalList input{'x', '+', 'y'};
+  earley::fast::Parser parser(compiled, input);
+  parser.parse_input();
+
+  LazyForest forest(parser);
+  CHECK(forest.nodes() == 0);
+
+  auto reductions = forest.reductions(
+    compiled->get_item(&rules[3], 1), 1, 1);
+  REQUIRE(reductions.end() - reductions.begin() == 1);
+  CHECK(reductions[0].item == compiled->get_item(&rules[0], 1));
+  CHECK(reductions[0].distance == 1);
+
+  // A scan has no reductions.
+  auto scanned = forest.reductions(compiled->get_item(&rules[3], 3), 3, 3);
+  CHECK(scanned.begin() == scanned.end());
+
+  // Visiting a node again doesn't add anything.
+  forest.reductions(compiled->get_item(&rules[3], 1), 1, 1);
+  CHECK(forest.nodes() == 2);
+}
+
+TEST_CASE("Goto cache", "[goto]")
+{
+  earley::Grammar grammar{
+    {
+      "S", {
+        {{"P"}},
+        {{"P", "S"}},
+      },
+    },
+    {
+      "P", {
+        {{'(', 'x', ')'}},
+      },
+    },
+  };
+
+  auto compiled = compile(Grammar("S", grammar));
+
+  TerminalList input;
+  for (int i = 0; i != 50; ++i)
+  {
+    input.insert(input.end(), {'(', 'x', ')'});
+  }
+
+  earley::fast::Parser parser(compiled, input);
+  parser.parse_input();
+  CHECK(parser.accepted());
+
+  // Nothing spans more than one P until the end, so the sets inside each P
+  // are the same every time.
+  auto& stats = parser.goto_stats();
+  CHECK(stats.hits + stats.misses == input.size());
+  CHECK(stats.hits > stats.misses);
+}
+
+TEST_CASE("Admissible items", "[lookahead]")
+{
+  earley::Grammar grammar{
+    {
+      "S", {
+        {{'a', "T"}},
+      },
+    },
+    {
+      "T", {
+        {{'b'}},
+        {{'c'}},
+      },
+    },
+  };
+
+  auto compiled = compile(Grammar("S", grammar));
+
+  // The bitsets agree with the lookahead of every item.
+  for (auto& rules: compiled->grammar().all_rules())
+  {
+    for (auto& rule: rules)
+    {
+      size_t length = rule.end() - rule.begin();
+      for (size_t dot = 0; dot <= length; ++dot)
+      {
+        auto item = compiled->get_item(&rule, dot);
+        for (int terminal: {'a', 'b', 'c', 'x'})
+        {
+          CHECK(CompiledGrammar::admits(compiled->admissible(terminal),
+            item->index()) == item->in_lookahead(terminal));
+        }
+
+        CHECK(CompiledGrammar::admits(
+          compiled->admissible(END_OF_INPUT),
+          item->index()));
+      }
+    }
+  }
+}
+
+TEST_CASE("Prediction closures", "[predictions]")
+{
+  earley::Grammar grammar{
+    {
+      "S", {
+        {{"A", "B", 'c'}},
+      },
+    },
+    {
+      "A", {
+        {{}},
+        {{'a', "A"}},
+      },
+    },
+    {
+      "B", {
+        {{'b'}},
+      },
+    },
+  };
+
+  auto compiled = compile(Grammar("S", grammar));
+  auto& g = compiled->grammar();
+  auto& s = g.rules("S").front();
+  auto& b = g.rules("B").front();
+
+  std::vector<const Item*> predictions;
+  for (auto item: compiled->predictions(s.nonterminal()))
+  {
+    predictions.push_back(item);
+  }
+
+  // A is nullable, so S predicts B as well, and moves past A.
+  std::vector<const Item*> expected{
+    compiled->get_item(&s, 0),
+    compiled->get_item(&s, 1),
+    compiled->get_item(&b, 0),
+  };
+  for (auto& rule: g.rules("A"))
+  {
+    expected.push_back(compiled->get_item(&rule, 0));
+  }
+
+  std::sort(predictions.begin(), predictions.end());
+  std::sort(expected.begin(), expected.end());
+  CHECK(predictions == expected);
+
+  std::vector<const Item*> b_predictions;
+  for (auto item: compiled->predictions(b.nonterminal()))
+  {
+    b_predictions.push_back(item);
+  }
+  CHECK(b_predictions == std::vector<const Item*>{compiled->get_item(&b, 0)});
+}
+
+TEST_CASE("Grammar tables", "[tables]")
+{
+  earley::Grammar grammar{
+    {
+      "S", {
+        {{'a'}},
+        {{"S", "Op", 'a'}, {"op", {1}}},
+      },
+    },
+    {
+      "Op", {
+        {{}},
+        {{'+'}},
+      },
+    },
+  };
+
+  auto compiled = compile(Grammar("S", grammar));
+  BuiltTables built(*compiled);
+  auto loaded = compile(built.tables());
+
+  auto& g = compiled->grammar();
+  auto& l = loaded->grammar();
+
+  REQUIRE(l.all_rules().size() == g.all_rules().size());
+  CHECK(loaded->start() == compiled->start());
+  CHECK(loaded->items() == compiled->items());
+  CHECK(l.rules("S").back().actions() == g.rules("S").back().actions());
+
+  for (size_t nonterminal = 0; nonterminal != g.all_rules().size();
+    ++nonterminal)
+  {
+    CHECK(l.nullable(nonterminal) == g.nullable(nonterminal));
+    CHECK(loaded->names().at(nonterminal) == compiled->names().at(nonterminal));
+
+    auto& rules = g.all_rules()[nonterminal];
+    auto& loaded_rules = l.all_rules()[nonterminal];
+    REQUIRE(loaded_rules.size() == rules.size());
+
+    for (size_t i = 0; i != rules.size(); ++i)
+    {
+      CHECK(std::equal(rules[i].begin(), rules[i].end(),
+        loaded_rules[i].begin(), loaded_rules[i].end()));
+
+      size_t length = rules[i].end() - rules[i].begin();
+      for (size_t dot = 0; dot <= length; ++dot)
+      {
+        auto item = compiled->get_item(&rules[i], dot);
+        auto loaded_item = loaded->get_item(&loaded_rules[i], dot);
+        CHECK(loaded_item->index() == item->index());
+        CHECK(loaded_item->empty_rhs() == item->empty_rhs());
+
+        for (int terminal: {'a', '+', 'x'})
+        {
+          CHECK(loaded_item->in_lookahead(terminal) ==
+            item->in_lookahead(terminal));
+        }
+      }
+    }
+
+    std::vector<size_t> predictions, loaded_predictions;
+    for (auto item: compiled->predictions(nonterminal))
+    {
+      predictions.push_back(item->index());
+    }
+    for (auto item: loaded->predictions(nonterminal))
+    {
+      loaded_predictions.push_back(item->index());
+    }
+    CHECK(loaded_predictions == predictions);
+  }
+
+  TerminalList input{'a', '+', 'a', 'a'};
+  earley::fast::Parser parser(loaded, input);
+  parser.parse_input();
+  CHECK(parser.accepted());
+}
+
+TEST_CASE("Binary grammar tables", "[tables]")
+{
+  earley::Grammar grammar{
+    {
+      "S", {
+        {{'a'}},
+        {{"S", "Op", 'a'}, {"op", {1}}},
+      },
+    },
+    {
+      "Op", {
+        {{}},
+        {{'+'}},
+      },
+    },
+  };
+
+  auto compiled = compile(Grammar("S", grammar));
+  BuiltTables built(*compiled);
+
+  std::ostringstream os;
+  write_tables(os, built.tables());
+  auto bytes = os.str();
+
+  // The tables are used in place, so they have to be aligned.
+  std::vector<uint64_t> aligned((bytes.size() + 7) / 8);
+  std::memcpy(aligned.data(), bytes.data(), bytes.size());
+  auto data = reinterpret_cast<const char*>(aligned.data());
+
+  MappedTables mapped(data, bytes.size());
+  auto& tables = mapped.tables();
+  CHECK(tables.nonterminals == built.tables().nonterminals);
+  CHECK(std::string(tables.names[0]) == built.tables().names[0]);
+  CHECK(reinterpret_cast<const char*>(tables.admissible) > data);
+  CHECK(reinterpret_cast<const char*>(tables.admissible) <
+    data + bytes.size());
+
+  auto loaded = compile(tables);
+  CHECK(loaded->items() == compiled->items());
+  CHECK(loaded->admissible(0) == tables.admissible);
+  CHECK(loaded->grammar().rules("S").back().actions() ==
+    compiled->grammar().rules("S").back().actions());
+
+  TerminalList input{'a', '+', 'a', 'a'};
+  earley::fast::Parser parser(loaded, input);
+  parser.parse_input();
+  CHECK(parser.accepted());
+
+  CHECK_THROWS_AS(MappedTables(data, bytes.size() - 8), BadTables);
+  CHECK_THROWS_AS(MappedTables(data + 8, bytes.size() - 8), BadTables);
+  CHECK_THROWS_AS(MappedTables("/nonexistent/grammar.tables"), BadTables);
+
+  // A copy of the data with `value` written over `field`, which points
+  // into the loaded tables.
+  auto corrupt = [&](const void* field, auto value) {
+    auto copy = aligned;
+    auto offset = static_cast<const char*>(field) - data;
+    std::memcpy(reinterpret_cast<char*>(copy.data()) + offset, &value,
+      sizeof(value));
+    return copy;
+  };
+
+  auto bad = [&](const std::vector<uint64_t>& copy) {
+    CHECK_THROWS_AS(MappedTables(reinterpret_cast<const char*>(copy.data()),
+      bytes.size()), BadTables);
+  };
+
+  SECTION("Offsets out of range")
+  {
+    bad(corrupt(tables.rule_offsets + 1, uint32_t(0xFFFFFF)));
+    bad(corrupt(tables.symbol_offsets + 1,
+      tables.symbol_offsets[2] + 1));
+    bad(corrupt(tables.prediction_offsets, uint32_t(1)));
+  }
+
+  SECTION("Indexes out of range")
+  {
+    auto symbols = tables.symbol_offsets[
+      tables.rule_offsets[tables.nonterminals]];
+    auto terminal = std::find_if(tables.symbols, tables.symbols + symbols,
+      [](const Symbol& symbol) { return symbol.terminal; });
+    auto nonterminal = std::find_if(tables.symbols, tables.symbols + symbols,
+      [](const Symbol& symbol) { return !symbol.terminal; });
+    REQUIRE(terminal != tables.symbols + symbols);
+    REQUIRE(nonterminal != tables.symbols + symbols);
+
+    bad(corrupt(&terminal->index, int(tables.terminals)));
+    bad(corrupt(&nonterminal->index, int(tables.nonterminals)));
+    bad(corrupt(&nonterminal->index, -1));
+    bad(corrupt(tables.predictions, uint32_t(tables.items)));
+    bad(corrupt(tables.nullable, uint8_t(2)));
+  }
+
+  SECTION("Sizes that don't agree")
+  {
+    auto changed = built.tables();
+    changed.start = changed.nonterminals;
+
+    std::ostringstream bad_start;
+    write_tables(bad_start, changed);
+    auto written = bad_start.str();
+    std::vector<uint64_t> copy((written.size() + 7) / 8);
+    std::memcpy(copy.data(), written.data(), written.size());
+    CHECK_THROWS_AS(MappedTables(reinterpret_cast<const char*>(copy.data()),
+      written.size()), BadTables);
+
+    changed = built.tables();
+    --changed.items;
+
+    std::ostringstream bad_items;
+    write_tables(bad_items, changed);
+    written = bad_items.str();
+    copy.assign((written.size() + 7) / 8, 0);
+    std::memcpy(copy.data(), written.data(), written.size());
+    CHECK_THROWS_AS(MappedTables(reinterpret_cast<const char*>(copy.data()),
+      written.size()), BadTables);
+  }
+}
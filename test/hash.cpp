@@ -2,6 +2,8 @@
 #include "earley_hash_set.hpp"
 
 #include <memory>
+#include <thread>
+#include <vector>
 
 template <typename Op>
 struct CountedOp
@@ -149,3 +151,207 @@ TEST_CASE("Counts", "[count]")
     CHECK(h.count(i) == 0);
   }
 }
+
+TEST_CASE("Group probing", "[group]")
+{
+  earley::HashSet<int, std::hash<int>, std::equal_to<int>,
+    earley::GroupProbing> h;
+  CHECK(h.capacity() == 0);
+  CHECK(h.find(3) == h.end());
+
+  for (int i = 0; i != 1000; i += 2)
+  {
+    CHECK(h.insert(i).second);
+  }
+  CHECK(h.size() == 500);
+  CHECK(h.capacity() % 16 == 0);
+  CHECK(h.insert(10).second == false);
+
+  for (int i = 0; i != 2000; ++i)
+  {
+    CHECK(h.count(i) == (i < 1000 && i % 2 == 0 ? 1 : 0));
+  }
+
+  int visited = 0;
+  for (auto i: h)
+  {
+    CHECK(i % 2 == 0);
+    ++visited;
+  }
+  CHECK(visited == 500);
+
+  auto capacity = h.capacity();
+  h.clear();
+  CHECK(h.size() == 0);
+  CHECK(h.capacity() == capacity);
+  CHECK(h.begin() == h.end());
+  CHECK(h.count(10) == 0);
+}
+
+TEST_CASE("Group probing compares few keys", "[group]")
+{
+  typedef CountedOp<std::equal_to<int>> Equal;
+  earley::HashSet<int, std::hash<int>, Equal, earley::GroupProbing> h;
+
+  for (int i = 0; i != 100; ++i)
+  {
+    h.insert(i);
+  }
+
+  // Only the slots whose control byte matches are compared.
+  auto before = Equal::counter();
+  for (int i = 100; i != 200; ++i)
+  {
+    h.find(i);
+  }
+  CHECK(Equal::counter() - before < 20);
+}
+
+TEST_CASE("Group probing map", "[group]")
+{
+  constexpr int inserts = 100;
+  auto destructs = DestructCounter::destructs;
+  {
+    earley::HashMap<int, std::unique_ptr<DestructCounter>,
+      std::hash<int>, std::equal_to<int>, earley::GroupProbing> h(3);
+
+    for (int i = 0; i != inserts; ++i)
+    {
+      h.emplace(i, std::make_unique<DestructCounter>());
+    }
+    h.emplace(7);
+
+    CHECK(h.size() == inserts);
+    CHECK(DestructCounter::destructs == destructs);
+
+    auto iter = h.find(7);
+    REQUIRE(iter != h.end());
+    CHECK(iter->second != nullptr);
+  }
+
+  CHECK(DestructCounter::destructs == destructs + inserts);
+}
+
+template <typename Set>
+void
+check_erase()
+{
+  Set h;
+  for (int i = 0; i != 1000; ++i)
+  {
+    h.insert(i);
+  }
+
+  for (int i = 0; i != 1000; i += 2)
+  {
+    CHECK(h.erase(i) == 1);
+  }
+  CHECK(h.erase(0) == 0);
+  CHECK(h.size() == 500);
+
+  for (int i = 0; i != 1000; ++i)
+  {
+    CHECK(h.count(i) == i % 2);
+  }
+
+  int visited = 0;
+  for (auto i: h)
+  {
+    CHECK(i % 2 == 1);
+    ++visited;
+  }
+  CHECK(visited == 500);
+
+  // Erasing the first element moves the start of the iteration.
+  auto first = *h.begin();
+  h.erase(h.begin());
+  CHECK(h.count(first) == 0);
+  CHECK(std::distance(h.begin(), h.end()) == 499);
+
+  // Churning the same number of keys reuses the tombstones rather than
+  // growing.
+  auto capacity = h.capacity();
+  for (int i = 1000; i != 100000; ++i)
+  {
+    h.insert(i);
+    h.erase(i);
+  }
+  CHECK(h.capacity() == capacity);
+  CHECK(h.size() == 499);
+}
+
+template <typename Set>
+void
+check_reserve()
+{
+  for (size_t count: {1, 10, 100, 1000, 12345})
+  {
+    Set h;
+    h.reserve(count);
+    auto capacity = h.capacity();
+    CHECK(capacity >= count);
+
+    for (size_t i = 0; i != count; ++i)
+    {
+      h.insert(i);
+    }
+    CHECK(h.capacity() == capacity);
+    CHECK(h.load_factor() == double(count) / capacity);
+  }
+}
+
+TEST_CASE("Erase", "[erase]")
+{
+  check_erase<earley::HashSet<int>>();
+  check_erase<earley::HashSet<int, std::hash<int>, std::equal_to<int>,
+    earley::GroupProbing>>();
+}
+
+TEST_CASE("Reserve", "[reserve]")
+{
+  check_reserve<earley::HashSet<int>>();
+  check_reserve<earley::HashSet<int, std::hash<int>, std::equal_to<int>,
+    earley::GroupProbing>>();
+}
+
+#ifdef EARLEY_HASH_STATS
+template <typename Set>
+void
+check_shared_stats()
+{
+  Set h;
+  for (int i = 0; i != 1000; ++i)
+  {
+    h.insert(i);
+  }
+
+  // Looking up through a const table from several threads at once counts
+  // every lookup.
+  auto before = h.stats().lookups.load();
+  const Set& shared = h;
+  std::vector<std::thread> threads;
+  for (int t = 0; t != 4; ++t)
+  {
+    threads.emplace_back([&shared] {
+      for (int i = 0; i != 10000; ++i)
+      {
+        shared.find(i % 2000);
+      }
+    });
+  }
+
+  for (auto& thread: threads)
+  {
+    thread.join();
+  }
+
+  CHECK(h.stats().lookups == before + 40000);
+}
+
+TEST_CASE("Stats from many threads", "[stats]")
+{
+  check_shared_stats<earley::HashSet<int>>();
+  check_shared_stats<earley::HashSet<int, std::hash<int>, std::equal_to<int>,
+    earley::GroupProbing>>();
+}
+#endif
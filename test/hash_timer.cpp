@@ -0,0 +1,150 @@
+#include <iostream>
+#include <vector>
+
+#include "earley/fast.hpp"
+#include "earley/timer.hpp"
+#include "earley_hash_set.hpp"
+
+// Compares the two kinds of HashTable. The first part times each of them
+// on its own, with pointer keys. The second part times parses, with the
+// parser's tables as they were built. Build it once as it is and once with
+// -DEARLEY_GROUP_PROBING=ON to compare the parses.
+
+namespace
+{
+  void
+  print_time(size_t, const std::string&, const earley::Timer&);
+
+  // Insert `keys`, then look up as many keys that are there as ones that
+  // aren't, a few times over.
+  template <typename Table>
+  void
+  time_table(const std::string& name, const std::vector<int*>& keys)
+  {
+    earley::Timer timer;
+    Table table(16);
+    for (auto key: keys)
+    {
+      table.insert(key);
+    }
+
+    size_t found = 0;
+    for (size_t round = 0; round != 4; ++round)
+    {
+      for (size_t i = 0; i != keys.size(); ++i)
+      {
+        found += table.count(keys[(i * 7919) % keys.size()]);
+        found += table.count(keys[i] + 1);
+      }
+    }
+
+    print_time(keys.size(), name, timer);
+    if (found != keys.size() * 4)
+    {
+      std::cout << "found " << found << " keys" << std::endl;
+    }
+  }
+
+  // A sum of products with brackets, with a deep left recursion and
+  // plenty of distinct sets.
+  earley::fast::TerminalList
+  expression(size_t terms)
+  {
+    earley::fast::TerminalList tokens;
+    for (size_t i = 0; i != terms; ++i)
+    {
+      if (i != 0)
+      {
+        tokens.push_back(i % 3 == 0 ? '*' : '+');
+      }
+
+      if (i % 5 == 0)
+      {
+        tokens.insert(tokens.end(), {'(', 'n', '+', 'n', ')'});
+      }
+      else
+      {
+        tokens.push_back('n');
+      }
+    }
+
+    return tokens;
+  }
+}
+
+int main(int, char**)
+{
+  for (size_t size: {size_t(10000), size_t(200000)})
+  {
+    std::vector<int*> keys;
+    for (size_t i = 0; i != size; ++i)
+    {
+      keys.push_back(new int);
+    }
+
+    time_table<earley::HashSet<int*>>("double hashing lookups", keys);
+    time_table<earley::HashSet<int*, std::hash<int*>, std::equal_to<int*>,
+      earley::GroupProbing>>("group probing lookups", keys);
+
+    for (auto key: keys)
+    {
+      delete key;
+    }
+  }
+
+  earley::Grammar grammar{
+    {"E", {
+      {{"E", '+', "T"}},
+      {{"T"}},
+    }},
+    {"T", {
+      {{"T", '*', "F"}},
+      {{"F"}},
+    }},
+    {"F", {
+      {{'n'}},
+      {{'(', "E", ')'}},
+    }},
+  };
+
+  auto compiled = earley::fast::compile(
+    earley::fast::grammar::Grammar("E", grammar));
+  auto tokens = expression(20000);
+
+#ifdef EARLEY_GROUP_PROBING
+  std::string name = "token parse with group probing";
+#else
+  std::string name = "token parse with double hashing";
+#endif
+
+  for (size_t run = 0; run != 3; ++run)
+  {
+    earley::fast::Parser parser(compiled, tokens);
+    earley::Timer timer;
+    auto error = parser.recognise();
+    print_time(tokens.size(), name, timer);
+
+    if (error)
+    {
+      std::cout << "parse failed at " << error->position << std::endl;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+namespace
+{
+  void
+  print_time
+  (
+    size_t size,
+    const std::string& operation,
+    const earley::Timer& timer
+  )
+  {
+    std::cout << size << " " << operation << " took " <<
+      timer.count<std::chrono::microseconds>() << " microseconds" << std::endl;
+  }
+}
@@ -0,0 +1,29 @@
+#include "catch.hpp"
+#include <earley/pool.hpp>
+
+#include <string>
+#include <vector>
+
+TEST_CASE("Pool objects don't move", "[pool]")
+{
+  earley::BlockPool<std::string> pool(2);
+
+  auto& first = pool.emplace_back("first");
+  std::vector<std::string*> added{&first};
+
+  for (size_t i = 0; i != 100; ++i)
+  {
+    added.push_back(&pool.emplace_back(std::to_string(i)));
+  }
+
+  CHECK(pool.size() == 101);
+  CHECK(&first == added.front());
+  CHECK(first == "first");
+  CHECK(&pool.back() == added.back());
+  CHECK(pool.back() == "99");
+
+  for (size_t i = 1; i != added.size(); ++i)
+  {
+    CHECK(*added[i] == std::to_string(i - 1));
+  }
+}
@@ -48,3 +48,69 @@ TEST_CASE("Stack", "[stack]")
 
   CHECK(s.top_size() == 3);
 }
+
+TEST_CASE("Reserved stack", "[stack]")
+{
+  Stack<int> s(earley::StackReserve{64 << 20});
+
+  // The sequence grows far past the first commit without moving.
+  auto values = s.start();
+  bool moved = false;
+  for (int i = 0; i != 1000000; ++i)
+  {
+    moved = moved || s.emplace_back(i) != values;
+  }
+  CHECK(!moved);
+  CHECK(s.top_size() == 1000000);
+  CHECK(values[999999] == 999999);
+  s.finalise();
+
+  auto next = s.start();
+  CHECK(next == values + 1000000);
+  s.emplace_back(5);
+  CHECK(*next == 5);
+  s.finalise();
+
+  // Trimming keeps everything that is in the stack.
+  s.trim();
+  CHECK(values[123456] == 123456);
+
+  s.release();
+  values = s.start();
+  CHECK(s.emplace_back(7) == values);
+  CHECK(*values == 7);
+  s.finalise();
+}
+
+TEST_CASE("Reserved stack is full", "[stack]")
+{
+  Stack<int> s(earley::StackReserve{4096});
+
+  s.start();
+  CHECK_THROWS_AS(
+    [&] {
+      for (size_t i = 0; i != 10000; ++i)
+      {
+        s.emplace_back(1);
+      }
+    }(),
+    std::bad_alloc);
+}
+
+TEST_CASE("Release a stack", "[stack]")
+{
+  Stack<int> s;
+  s.start();
+  for (size_t i = 0; i != 5000; ++i)
+  {
+    s.emplace_back(i);
+  }
+
+  CHECK_THROWS_AS(s.release(), earley::StackOwned);
+  s.finalise();
+  s.release();
+
+  auto values = s.start();
+  CHECK(s.emplace_back(3) == values);
+  CHECK(s.top_size() == 1);
+}